@@ -1,25 +1,74 @@
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 #include "driver/gpio.h"
 #include "driver/i2c.h"
+#include "driver/ledc.h"
+#include "driver/uart.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_partition.h"
+#include "esp_rom_sys.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "mbedtls/md.h"
+#include "mbedtls/pkcs5.h"
 
 // Hardware Configuration
 #define ROWS 4
 #define COLS 4
 #define LOCK_PIN GPIO_NUM_4
+#define LOCK_RELEASE_PIN GPIO_NUM_23  // H-bridge reverse input, LOCK_DRIVE_PULSE only
 #define GUEST_LED_PIN GPIO_NUM_18  // LED pin for guest password usage
 #define MASTER_LED_PIN GPIO_NUM_5  // LED pin for master password usage
+#define DOOR_SENSOR_PIN GPIO_NUM_19  // Reed switch to GND, closed by the magnet on the lid
+#define DOOR_CLOSED_LEVEL 0
+#define DOOR_DEBOUNCE_MS 50
+#define DOOR_RELOCK_GRACE_MS 3000  // Relock this long after the door closes
 #define DEBOUNCE_DELAY_MS 20
-#define SCAN_INTERVAL_MS 30
-#define UNLOCK_DURATION_MS 3000
-#define LED_BLINK_DURATION_MS 3000  // Duration for LED to blink when password is used
+#define SCAN_INTERVAL_MS 5  // Matrix sample period while any key is active
+#define DEBOUNCE_SAMPLES (DEBOUNCE_DELAY_MS / SCAN_INTERVAL_MS)  // Equal samples to change a key
+#define DEBOUNCE_MASK ((1u << DEBOUNCE_SAMPLES) - 1)
+#define COLUMN_SETTLE_US 10  // Row pull-ups recovering after a column is released
+
+// Key Event Ring
+#define KEY_RING_SIZE 16  // Power of two; holds KEY_RING_SIZE - 1 events
+#define KEY_RING_DROP_OLDEST 0  // Overwrite the oldest queued event
+#define KEY_RING_DROP_NEWEST 1  // Discard the event that did not fit
+#define KEY_RING_COALESCE 2     // Merge back-to-back repeats, hold one other event until there is room
+#define KEY_RING_POLICY KEY_RING_DROP_NEWEST
+#define LED_PWM_FREQ_HZ 5000
+#define LOCK_PWM_FREQ_HZ 20000  // Above audible range for the solenoid
+#define LOCK_DUTY_MAX ((1 << LEDC_TIMER_10_BIT) - 1)
+#define LOCK_PULL_IN_MS 200     // Full power to pull the plunger in
+#define LOCK_HOLD_DUTY_PCT 30   // Enough to hold it once seated
+#define LOCK_COIL_MW 6000       // Coil power at full drive (12 V, 0.5 A)
+#define LOCK_DRIVE_PWM_HOLD 0   // Pull-in pulse, then PWM hold until relock
+#define LOCK_DRIVE_PULSE 1      // Pull-in pulse, then a reverse pulse on relock, for latching locks
+#define LOCK_DRIVE_MODE LOCK_DRIVE_PWM_HOLD
+#define LED_DUTY_MAX ((1 << LEDC_TIMER_10_BIT) - 1)
 #define UNLOCK_DURATION_MS 60000  // 1 minute unlock duration
+#define UNLOCK_MAX_MS (5 * 60000)  // Longest an unlock can be extended to, from the PIN that opened it
+#define RELOCK_TICK_MS (UNLOCK_DURATION_MS / (LCD_COLUMNS * 5))  // One progress bar pixel per tick
+#define APP_NOTIFY_KEYS (1u << 0)    // Key events waiting in key_ring
+#define APP_NOTIFY_RELOCK (1u << 1)  // Relock timer expired
+#define APP_NOTIFY_FORCED (1u << 2)  // Door opened while locked
+#define APP_NOTIFY_PROVISION (1u << 3)  // Courier batch staged by the console
+#define APP_NOTIFY_OTP_SECRET (1u << 4) // OTP secret staged by the console
+#define APP_NOTIFY_NVS_FLUSH (1u << 5)  // NVS write cache deferral expired
+#define APP_NOTIFY_CRED_RESET (1u << 6) // Credential table reset confirmed on the console
 
 // Keypad GPIO Pins
 const gpio_num_t row_pins[ROWS] = {GPIO_NUM_13, GPIO_NUM_12, GPIO_NUM_14, GPIO_NUM_27};
@@ -37,6 +86,8 @@ static const char keymap[ROWS][COLS] = {
 #define I2C_MASTER_SCL_IO GPIO_NUM_22
 #define I2C_MASTER_SDA_IO GPIO_NUM_21
 #define I2C_MASTER_NUM I2C_NUM_0
+#define I2C_MASTER_FREQ_HZ 100000
+#define I2C_TIMEOUT_MS 50  // A full 160-byte batch takes ~15 ms at 100 kHz
 #define LCD_ADDR 0x27
 #define LCD_COLUMNS 16
 #define LCD_ROWS 2
@@ -47,10 +98,136 @@ static const char keymap[ROWS][COLS] = {
 #define LCD_ENTRY_MODE_SET 0x04
 #define LCD_DISPLAY_CONTROL 0x08
 #define LCD_FUNCTION_SET 0x20
+#define LCD_CURSOR_SHIFT 0x10
+#define LCD_DISPLAY_MOVE 0x08
+#define LCD_MOVE_RIGHT 0x04
+#define LCD_SET_CGRAM_ADDR 0x40
 #define LCD_SET_DDRAM_ADDR 0x80
 #define LCD_BACKLIGHT 0x08
 #define LCD_DATA 0x01
 #define LCD_COMMAND 0x00
+#define LCD_ENABLE 0x04
+#define LCD_BATCH_MAX 40  // HD44780 bytes per I2C transaction
+#define LCD_CGRAM_SLOTS 8
+#define LCD_GLYPH_BASE 0x10  // Frame cell codes 0x10.. name custom glyphs (blank in the HD44780 ROM)
+#define LCD_GLYPH(id) ((char)(LCD_GLYPH_BASE + (id)))
+#define LCD_IS_GLYPH(c) ((uint8_t)(c) >= LCD_GLYPH_BASE && (uint8_t)(c) < LCD_GLYPH_BASE + GLYPH_COUNT)
+#define LCD_CELL_STALE 0x00  // Shadow marker for a cell whose glyph was evicted
+#define LCD_DDRAM_LINE 40  // DDRAM characters per line, visible or not
+#define LCD_MARQUEE_STEP_MS 400
+#define LCD_MARQUEE_PAUSE_STEPS 4  // Steps to hold at either end of the scroll
+
+// LCD Bus Health
+#define LCD_BUS_TRIP_CONSECUTIVE 3  // Failed transactions in a row that open the breaker
+#define LCD_BUS_TRIP_WINDOW 8       // ...or a majority of the last LCD_BUS_TRIP_WINDOW transactions
+#define LCD_BUS_TRIP_FAILURES (LCD_BUS_TRIP_WINDOW / 2 + 1)
+#define LCD_BUS_RETRY_MIN_MS 500
+#define LCD_BUS_RETRY_MAX_MS 30000
+
+// Key Latency Histograms
+// Log-linear buckets: exact below LAT_SUB us, then LAT_SUB buckets per power
+// of two (12.5% resolution), clamped at 2^LAT_MAX_LOG2 us (~67 s)
+#define LAT_SUB_BITS 3
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_MAX_LOG2 26
+#define LAT_BUCKETS ((LAT_MAX_LOG2 - LAT_SUB_BITS + 2) * LAT_SUB)
+#define LAT_CONSOLE_UART UART_NUM_0
+
+// Credentials
+// PBKDF2-HMAC-SHA256 through mbedtls, which uses the SHA accelerator when
+// CONFIG_MBEDTLS_HARDWARE_SHA is set. One salt per box makes a PIN's digest
+// deterministic so it can key the hash index: a lookup is one KDF and one
+// probe, however many credentials are stored.
+#define CRED_SALT_LEN 16
+#define CRED_DIGEST_LEN 16           // Truncated PBKDF2 output kept per entry
+#define CRED_KDF_ITERATIONS 1024     // Retune with the console 'k' command; set when the table is created
+#define CRED_VERIFY_BUDGET_MS 150    // Per verification, for 'k'
+#define CRED_CALIBRATE_ITERATIONS 256
+// Static DRAM is 28 bytes per table entry and per batch entry plus 8 bytes of
+// index per table entry: 56 KiB + 28 KiB + 16 KiB, about 100 KiB at the
+// values below. Check the DRAM left before raising either.
+#ifndef CRED_TABLE_MAX
+#define CRED_TABLE_MAX 2048          // Power of two; cred_entries, 28 bytes each
+#endif
+#define CRED_BATCH_MAX 1024          // Courier codes, 28 bytes each; the batch blob needs an NVS partition over 28 KiB
+#define CRED_INDEX_SIZE (CRED_TABLE_MAX * 4)  // Table and batch at a load factor at or below 1/2, 2 bytes a slot
+#define CRED_PIN_MAX 5               // Master and guest PIN digits
+#define CRED_CODE_DIGITS 9           // Courier codes; also the longest keypad entry
+#define CRED_CODE_SPACE 1000000000   // 10^CRED_CODE_DIGITS
+
+// Consumed Code Bitmap
+// One bit per courier batch slot, kept in a record on a dedicated flash
+// sector (partition "consumed", data subtype 0x40, 4 KiB)
+#define CONSUMED_PARTITION "consumed"
+#define CONSUMED_SUBTYPE 0x40
+#define CONSUMED_MAGIC 0x534E4F43  // "CONS"
+#define CONSUMED_SECTOR_SIZE 4096
+#define CONSUMED_BITMAP_BYTES (CRED_BATCH_MAX / 8)
+#define CONSUMED_RECORD_SIZE (8 + CONSUMED_BITMAP_BYTES)
+#define CONSUMED_RECORDS (CONSUMED_SECTOR_SIZE / CONSUMED_RECORD_SIZE)  // Batches per sector erase
+
+// One-Time Courier Codes
+// HOTP (RFC 4226) and TOTP (RFC 6238) over HMAC-SHA1 with a per-box secret,
+// at the RFC's longest 8 digits: the window below keeps about 37 codes live
+#define OTP_SECRET_LEN 20
+#define OTP_DIGITS 8
+#define OTP_MODULUS 100000000
+#define OTP_HOTP_LOOKAHEAD 32      // Counters searched from hotp_base, at most 64
+#define OTP_TOTP_STEP_S 60
+#define OTP_TOTP_SKEW 2            // Steps accepted either side of the current one
+#define OTP_TOTP_REDEEMED 8        // Recent steps remembered against replay
+#define OTP_CLOCK_VALID 1700000000 // TOTP and time-bounded PINs need the clock set past this
+
+// Attempt Rate Limiting
+// A token bucket per input channel: RATE_BURST wrong PINs back to back, then
+// a lockout that doubles with every further strike up to RATE_BACKOFF_MAX_MS
+#define RATE_BURST 3                   // The README's three incorrect attempts
+#define RATE_REFILL_MS (60 * 60 * 1000)  // One attempt regained per interval, counted from the last lockout
+#define RATE_BACKOFF_BASE_MS 30000     // First lockout
+#define RATE_BACKOFF_MAX_MS (4 * 60 * 60 * 1000)
+#define RATE_STRIKES_MAX 16            // Saturates well past the cap
+#define RATE_RTC_MAGIC 0x52415445      // "RATE"
+
+// NVS Write Cache
+#define NVS_CACHE_DEFER_MS 2000        // Routine saves are committed together this long after the first
+#define CRED_NVS_CHUNK 64            // Entries per NVS blob
+#define CRED_USES_UNLIMITED 0xFFFF
+#define CRED_ID_MASTER 0             // The keypad settings menu edits these two
+#define CRED_ID_GUEST 1
+
+// Compile-time LCD encoding, same byte layout as lcd_encode()
+#define LCD_ENC(v, mode) \
+    (uint8_t)(((v) & 0xF0) | LCD_BACKLIGHT | (mode) | LCD_ENABLE), \
+    (uint8_t)(((v) & 0xF0) | LCD_BACKLIGHT | (mode)), \
+    (uint8_t)((((v) << 4) & 0xF0) | LCD_BACKLIGHT | (mode) | LCD_ENABLE), \
+    (uint8_t)((((v) << 4) & 0xF0) | LCD_BACKLIGHT | (mode))
+#define LCD_CH(s, i) ((i) < sizeof(s) - 1 ? (s)[i] : ' ')  // Space-padded, truncated at LCD_COLUMNS
+#define LCD_TEXT_ROW(s) { LCD_CH(s, 0), LCD_CH(s, 1), LCD_CH(s, 2), LCD_CH(s, 3), LCD_CH(s, 4), LCD_CH(s, 5), LCD_CH(s, 6), LCD_CH(s, 7), LCD_CH(s, 8), LCD_CH(s, 9), LCD_CH(s, 10), LCD_CH(s, 11), LCD_CH(s, 12), LCD_CH(s, 13), LCD_CH(s, 14), LCD_CH(s, 15) }
+#define LCD_ENC_ROW(row, s) \
+    LCD_ENC(LCD_SET_DDRAM_ADDR | ((row) * 0x40), LCD_COMMAND), \
+    LCD_ENC(LCD_CH(s, 0), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 1), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 2), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 3), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 4), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 5), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 6), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 7), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 8), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 9), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 10), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 11), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 12), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 13), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 14), LCD_DATA), \
+    LCD_ENC(LCD_CH(s, 15), LCD_DATA)
+#define LCD_TEMPLATE_BYTES (LCD_ROWS * (LCD_COLUMNS + 1) * 4)
+#define LCD_TEMPLATE(label, row0, row1) { \
+    .name = label, \
+    .text = { row0, row1 }, \
+    .cells = { LCD_TEXT_ROW(row0), LCD_TEXT_ROW(row1) }, \
+    .stream = { LCD_ENC_ROW(0, row0), LCD_ENC_ROW(1, row1) } \
+}
 
 // Menu States
 typedef enum {
@@ -60,85 +237,751 @@ typedef enum {
     CHANGE_MASTER_PASSWORD,
     CHANGE_GUEST_PASSWORD,
     VERIFY_MASTER_PASSWORD,
-    LOCKED_STATE
+    LOCKED_STATE,
+    DOOR_UNLOCKED     // Counting down to relock; 'A' + master PIN + '#' extends, 'C' relocks now
 } menu_state_t;
 
+// Custom Glyphs
+typedef enum {
+    GLYPH_LOCK,
+    GLYPH_UNLOCK,
+    GLYPH_DOT,
+    GLYPH_CHECK,
+    GLYPH_CROSS,
+    GLYPH_BAR_1,
+    GLYPH_BAR_2,
+    GLYPH_BAR_3,
+    GLYPH_BAR_4,
+    GLYPH_BAR_5,
+    GLYPH_COUNT
+} lcd_glyph_t;
+
 // Keypad event structure
 typedef struct {
     char key;
     bool is_pressed;
+    int64_t onset_us;      // First sample that differed from the stable state
+    int64_t captured_us;   // When the new state became stable
 } keypad_event_t;
 
+// Credential roles; CRED_ROLE_NONE marks a free id
+typedef enum {
+    CRED_ROLE_NONE,
+    CRED_ROLE_MASTER,
+    CRED_ROLE_GUEST,
+    CRED_ROLE_COURIER      // One-time code from a provisioned batch
+} cred_role_t;
+
+// One PIN. Ids are array positions and stay stable until the entry is
+// removed; ids from CRED_TABLE_MAX up are courier batch entries.
+typedef struct {
+    uint8_t digest[CRED_DIGEST_LEN];
+    uint32_t valid_from;   // Unix time, 0 = immediately
+    uint32_t expires;      // Unix time, 0 = never
+    uint16_t uses_left;    // CRED_USES_UNLIMITED never runs out
+    uint8_t role;          // cred_role_t
+    uint8_t reserved;
+} cred_entry_t;
+
+_Static_assert(sizeof(cred_entry_t) == 28, "cred_entry_t is stored in NVS");
+_Static_assert(CRED_INDEX_SIZE >= 2 * (CRED_TABLE_MAX + CRED_BATCH_MAX), "cred_index too small");
+_Static_assert(CRED_TABLE_MAX + CRED_BATCH_MAX < 0xFFFF, "cred_index holds 16-bit ids");
+
+// Stored as "cred_hdr"; entries follow in "cred_0", "cred_1", ... blobs of
+// CRED_NVS_CHUNK, so boot reads them straight into cred_entries
+typedef struct {
+    uint8_t salt[CRED_SALT_LEN];
+    uint32_t iterations;
+    uint16_t used;         // Ids at or above this have never been allocated
+    uint16_t count;
+} cred_header_t;
+
+// Courier batch, stored as one "cred_batch" blob cut to count entries. The
+// entries never change once applied; which ones are used is kept in the
+// consumed bitmap.
+typedef struct {
+    uint16_t count;
+    uint16_t reserved;
+    uint32_t id;           // Random and non-zero per apply, ties the batch to its bitmap
+    uint32_t crc;          // esp_rom_crc32_le over entries[0..count)
+    cred_entry_t entries[CRED_BATCH_MAX];
+} cred_batch_t;
+
+// Header of a consumed bitmap record; CONSUMED_BITMAP_BYTES follow
+typedef struct {
+    uint32_t magic;
+    uint32_t batch_id;     // cred_batch.id the bitmap belongs to
+} consumed_header_t;
+
+_Static_assert(sizeof(consumed_header_t) + CONSUMED_BITMAP_BYTES == CONSUMED_RECORD_SIZE, "record layout");
+
+// HOTP/TOTP redemption window, stored as the "otp_state" blob
+typedef struct {
+    uint64_t hotp_base;        // Lowest counter not known to be redeemed
+    uint64_t hotp_redeemed;    // Bit i set: counter hotp_base + i redeemed
+    uint32_t totp_redeemed[OTP_TOTP_REDEEMED];  // Ring of redeemed time steps
+    uint32_t totp_next;
+} otp_state_t;
+
+// Input channels with their own attempt bucket
+typedef enum {
+    RATE_CH_KEYPAD,
+    RATE_CH_WEB,     // Web login, once it moves into this firmware
+    RATE_CH_REMOTE,  // Remote unlock API
+    RATE_CH_COUNT
+} rate_channel_t;
+
+// Attempt bucket. Times are esp_timer milliseconds, so they restart at boot.
+typedef struct {
+    uint8_t tokens;
+    uint8_t strikes;           // Lockouts since the last correct PIN
+    bool dirty;                // Wrong PINs since the last correct one
+    int64_t refilled_ms;       // Refill is counted from here
+    int64_t locked_until_ms;
+} rate_bucket_t;
+
+// Kept in RTC memory, which survives a reset but not power loss; checked
+// with a CRC because it is not initialised at power-on
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;              // Over buckets
+    rate_bucket_t buckets[RATE_CH_COUNT];
+} rate_rtc_t;
+
+// What power loss must not forget, stored as the "rate_state" blob
+typedef struct {
+    uint8_t strikes;
+    uint8_t dirty;
+} rate_saved_t;
+
+// Records persisted through the NVS write cache. Their data stays in the
+// owners' globals; the cache tracks which ones need writing.
+typedef enum {
+    NVS_FIELD_CRED_HDR,
+    NVS_FIELD_CRED_BATCH,
+    NVS_FIELD_OTP_SECRET,
+    NVS_FIELD_OTP_STATE,
+    NVS_FIELD_RATE_STATE,
+    NVS_FIELD_CONSUMED,    // Only without the "consumed" partition
+    NVS_FIELD_CRED_CHUNK,  // "cred_0" here, one field per CRED_NVS_CHUNK entries
+    NVS_FIELD_COUNT = NVS_FIELD_CRED_CHUNK + (CRED_TABLE_MAX + CRED_NVS_CHUNK - 1) / CRED_NVS_CHUNK
+} nvs_field_t;
+
+// NVS write cache counters since boot
+typedef struct {
+    uint32_t marks;        // Records saved by their owners; each used to be an nvs_set
+    uint32_t saves;        // Save points; each used to be an nvs_commit
+    uint32_t writes;       // Records written
+    uint32_t skipped;      // Saved records that matched what NVS already held
+    uint32_t bytes;        // Bytes written
+    uint32_t commits;
+    uint32_t failures;     // Flushes that left records dirty for the next one
+    int64_t flush_us;      // Time spent writing and committing
+    int64_t flush_us_max;
+} nvs_cache_stats_t;
+
 // System Structure
 typedef struct {
-    char master_password[6];    // Master password
-    char guest_password[6];     // Guest password
-    char input_buffer[6];
+    char input_buffer[CRED_CODE_DIGITS + 1];
     int input_pos;
     menu_state_t state;
     menu_state_t previous_state;
     char last_key;
     bool authenticated;
-    bool guest_password_used;   // Flag to track if guest password has been used
+    bool extending;             // DOOR_UNLOCKED: 'A' pressed, reading the master PIN
 } lock_system_t;
 
+// Batched LCD transport buffer, up to LCD_BATCH_MAX HD44780 bytes per transaction
+typedef struct {
+    uint8_t buf[LCD_BATCH_MAX * 4];
+    size_t len;
+} lcd_batch_t;
+
+// LCD bus counters (totals since boot and for the screen being drawn)
+typedef struct {
+    uint32_t total_bytes;
+    uint32_t total_transactions;
+    uint32_t screen_bytes;
+    uint32_t screen_transactions;
+} lcd_stats_t;
+
+// Static screen, pre-encoded at build time into a flash-resident PCF8574
+// stream (cursor to each row start followed by every cell of that row)
+typedef struct {
+    const char *name;
+    const char *text[LCD_ROWS];  // Full lines, may run past LCD_COLUMNS
+    char cells[LCD_ROWS][LCD_COLUMNS];
+    uint8_t stream[LCD_TEMPLATE_BYTES];
+} lcd_template_t;
+
+// Desired screen contents, handed from the state machine to the render task
+typedef struct {
+    char cells[LCD_ROWS][LCD_COLUMNS];
+    const lcd_template_t *tmpl;  // Template the frame was built from
+    int64_t key_onset_us;        // Onset of the key that led to this frame, 0 if none
+    int64_t published_us;
+} lcd_screen_t;
+
+// CGRAM slot in the glyph cache
+typedef struct {
+    int8_t glyph;        // Resident glyph, -1 if the slot is free
+    uint32_t last_used;  // LRU stamp
+} lcd_cgram_slot_t;
+
+// Marquee state for screens with lines longer than the panel
+typedef struct {
+    const lcd_template_t *tmpl;    // Screen being scrolled, NULL if none
+    const lcd_template_t *hidden;  // Template whose hidden columns are in DDRAM
+    uint8_t length;                // Characters written per DDRAM line
+    uint8_t offset;                // Current display shift
+    bool backwards;                // Scrolling back towards offset 0
+    uint8_t pause;                 // Steps left to hold at an end
+} lcd_marquee_t;
+
+// Single-producer/single-consumer key event ring (keypad task -> app task).
+// head is written only by the producer. tail is only ever advanced by
+// compare-and-swap: by the consumer once it has read a slot, and by the
+// producer under KEY_RING_DROP_OLDEST to discard the oldest event.
+typedef struct {
+    keypad_event_t slots[KEY_RING_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    keypad_event_t pending;      // KEY_RING_COALESCE overflow (producer only)
+    bool has_pending;
+    keypad_event_t last;         // Last event pushed (producer only)
+    bool last_queued;            // ... and it was published or is pending, not dropped
+    uint32_t drops;              // Producer only
+    uint32_t coalesced;          // Producer only
+    uint32_t high_water;         // Producer only
+} key_ring_t;
+
+// Lock solenoid drive phase
+typedef enum {
+    LOCK_ACT_OFF,
+    LOCK_ACT_PULL_IN,
+    LOCK_ACT_HOLD,
+    LOCK_ACT_LATCHED,  // LOCK_DRIVE_PULSE: unpowered but open until the release pulse
+    LOCK_ACT_RELEASE   // LOCK_DRIVE_PULSE: reverse pulse on LOCK_RELEASE_PIN
+} lock_act_state_t;
+
+// Lock actuator with per-actuation energy accounting
+typedef struct {
+    lock_act_state_t state;
+    SemaphoreHandle_t mutex;        // App and esp_timer tasks
+    esp_timer_handle_t pull_in_timer;
+    int64_t pull_in_us;             // Start of the current actuation
+    int64_t hold_us;                // Start of its hold phase, 0 if not reached
+    uint32_t actuations;
+    uint32_t last_mj;
+    uint64_t total_mj;
+} lock_actuator_t;
+
+// Status LEDs, one LEDC channel each
+typedef enum {
+    LED_MASTER,
+    LED_GUEST,
+    LED_COUNT
+} led_id_t;
+
+typedef enum {
+    LED_PATTERN_OFF,
+    LED_PATTERN_BLINK_3,    // Password accepted
+    LED_PATTERN_UNLOCKED,   // Blink 3 then breathe until relocked
+    LED_PATTERN_BREATHE,
+    LED_PATTERN_STROBE,     // Tamper
+    LED_PATTERN_COUNT
+} led_pattern_id_t;
+
+// One step: fade to duty_pct over fade_ms (0 = jump), then hold
+typedef struct {
+    uint8_t duty_pct;
+    uint16_t fade_ms;
+    uint16_t hold_ms;
+} led_step_t;
+
+typedef struct {
+    const led_step_t *steps;
+    uint8_t count;
+    uint8_t repeat;             // Passes through steps, 0 = until replaced
+    led_pattern_id_t next;      // Played when the repeats are done
+} led_pattern_t;
+
+// Pattern playing on an LED, owned by the esp_timer task
+typedef struct {
+    ledc_channel_t channel;
+    gpio_num_t pin;
+    esp_timer_handle_t timer;   // Fires when the current step is done
+    atomic_int requested;       // Pattern to switch to + 1, set by led_play
+    const led_pattern_t *pattern;
+    uint8_t step;
+    uint8_t pass;
+} led_state_t;
+
+// LCD bus circuit breaker
+typedef enum {
+    LCD_BUS_OK,
+    LCD_BUS_DOWN,        // Breaker open, writes are dropped until recovery
+    LCD_BUS_RECOVERING   // Bus cleared, panel being probed and re-initialised
+} lcd_bus_state_t;
+
+typedef struct {
+    lcd_bus_state_t state;
+    uint32_t history;        // Last 32 transactions, bit set = failed
+    uint8_t consecutive;     // Failures in a row
+    uint32_t retry_ms;       // Backoff before the next recovery attempt
+    TickType_t retry_at;     // When that attempt is due
+    uint32_t errors;
+    uint32_t trips;
+    uint32_t recoveries;
+    esp_err_t last_error;
+} lcd_bus_health_t;
+
+// Key-to-display pipeline stages
+typedef enum {
+    LAT_DEBOUNCE,   // Key onset to stable event (scan interval and debounce)
+    LAT_QUEUE,      // Event to dequeue in app_task
+    LAT_HANDLE,     // Dequeue to handle_keypress returning
+    LAT_RENDER,     // Frame published to flushed to the panel
+    LAT_TOTAL,      // Key onset to the panel
+    LAT_STAGES
+} lat_stage_t;
+
+// Fixed-size latency histogram, one writer task per stage
+typedef struct {
+    uint32_t generation;  // lat_generation when its writer last cleared it
+    uint32_t count;
+    uint32_t max_us;
+    uint32_t buckets[LAT_BUCKETS];
+} lat_hist_t;
+
 // Global Variables
-static QueueHandle_t keypad_queue;
+static lcd_stats_t lcd_stats;
+static char lcd_shadow[LCD_ROWS][LCD_COLUMNS];  // What the panel currently shows (render task only)
+static lcd_screen_t lcd_frame;                  // Frame being composed (app task only)
+static QueueHandle_t lcd_queue;                 // Latest published frame, length 1
+static lcd_cgram_slot_t lcd_cgram[LCD_CGRAM_SLOTS];  // Glyph cache (render task only)
+static uint32_t lcd_cgram_clock;
+static uint32_t lcd_cgram_loads;
+static lcd_marquee_t lcd_marquee;  // Render task only
+static lcd_bus_health_t lcd_bus;   // Render task only after hardware_init
+static lcd_screen_t lcd_last;      // Latest frame received, redrawn after recovery
+static key_ring_t key_ring;
+static TaskHandle_t app_task_handle;     // Notified when key events are pushed
+static TaskHandle_t keypad_task_handle;  // Notified by the row interrupts
+static uint8_t keypad_history[ROWS * COLS];  // Last DEBOUNCE_SAMPLES raw samples per key (keypad task only)
+static uint16_t keypad_stable;               // Debounced state, bit r * COLS + c set while held
+static int64_t keypad_onset_us[ROWS * COLS];
+static lat_hist_t lat_hist[LAT_STAGES];
+static atomic_uint lat_generation;  // Bumped by console 'r'; each writer clears its own stage
+static int64_t lat_key_onset_us;  // Key being handled, stamped on its first frame (app task only)
 static lock_system_t lock_system;
+static cred_header_t cred_hdr;
+static cred_entry_t cred_entries[CRED_TABLE_MAX];
+static cred_batch_t cred_batch;
+static uint16_t cred_index[CRED_INDEX_SIZE];  // Open addressing over digests: id + 1, 0 = empty
+static cred_entry_t *cred_batch_staged;       // Console -> app_task hand-off
+static int cred_batch_staged_count;
+static bool cred_table_failed;                // Stored table unreadable: no PIN is accepted
+static TaskHandle_t console_task_handle;
+static const esp_partition_t *consumed_part;    // NULL: bitmap kept in NVS instead
+static int consumed_record;                      // Record holding the current batch's bitmap
+static uint8_t consumed_bits[CONSUMED_BITMAP_BYTES];  // Bit clear = slot used, as on flash
+static uint32_t consumed_erases;                 // Sector erases since boot
+static uint8_t otp_secret[OTP_SECRET_LEN];
+static uint8_t otp_secret_staged[OTP_SECRET_LEN];  // Console -> app_task hand-off
+static otp_state_t otp_state;
+static RTC_NOINIT_ATTR rate_rtc_t rate_rtc;   // Attempt buckets, updated on every attempt
+static uint32_t rate_nvs_writes;              // "rate_state" saves since boot
+static rate_saved_t rate_saved[RATE_CH_COUNT];
+static uint32_t nvs_cache_dirty[(NVS_FIELD_COUNT + 31) / 32];
+static uint32_t nvs_cache_crc[NVS_FIELD_COUNT];  // Of each record as NVS holds it, 0 = unknown
+static TimerHandle_t nvs_cache_timer;            // One-shot, running while saves are deferred
+static nvs_cache_stats_t nvs_cache_stats;
+static TimerHandle_t relock_timer;  // One-shot, running while the door is unlocked
+static TickType_t unlock_started;   // Start of the current unlock, for UNLOCK_MAX_MS
+static TimerHandle_t door_timer;    // Door sensor debounce, restarted by each edge
+static bool door_open;              // Debounced sensor state (timer service task only)
+static atomic_bool door_opened;     // Door opened since the last unlock
+static uint32_t door_forced_count;
+static lock_actuator_t lock_actuator;
+static led_state_t leds[LED_COUNT] = {
+    [LED_MASTER] = { .channel = LEDC_CHANNEL_0, .pin = MASTER_LED_PIN },
+    [LED_GUEST] = { .channel = LEDC_CHANNEL_1, .pin = GUEST_LED_PIN },
+};
+static bool effect_message_held;    // A status message owns the panel (app task only)
+static TickType_t effect_message_until;
 static nvs_handle_t nvs_handler;
 
+// LED Patterns
+static const led_step_t led_steps_off[] = { {0, 0, 0} };
+static const led_step_t led_steps_blink[] = { {100, 0, 200}, {0, 0, 200} };
+static const led_step_t led_steps_breathe[] = { {60, 1000, 100}, {0, 1000, 400} };
+static const led_step_t led_steps_strobe[] = { {100, 0, 40}, {0, 0, 60} };
+
+static const led_pattern_t led_patterns[LED_PATTERN_COUNT] = {
+    [LED_PATTERN_OFF]      = { led_steps_off, 1, 1, LED_PATTERN_OFF },
+    [LED_PATTERN_BLINK_3]  = { led_steps_blink, 2, 3, LED_PATTERN_OFF },
+    [LED_PATTERN_UNLOCKED] = { led_steps_blink, 2, 3, LED_PATTERN_BREATHE },
+    [LED_PATTERN_BREATHE]  = { led_steps_breathe, 2, 0, LED_PATTERN_OFF },
+    [LED_PATTERN_STROBE]   = { led_steps_strobe, 2, 0, LED_PATTERN_OFF },
+};
+
+// 5x8 glyph bitmaps, one row per byte
+static const uint8_t lcd_glyph_rows[GLYPH_COUNT][8] = {
+    [GLYPH_LOCK]   = {0x0E, 0x11, 0x11, 0x1F, 0x1B, 0x1B, 0x1F, 0x00},
+    [GLYPH_UNLOCK] = {0x0E, 0x10, 0x10, 0x1F, 0x1B, 0x1B, 0x1F, 0x00},
+    [GLYPH_DOT]    = {0x00, 0x00, 0x0E, 0x1F, 0x1F, 0x0E, 0x00, 0x00},
+    [GLYPH_CHECK]  = {0x00, 0x01, 0x03, 0x16, 0x1C, 0x08, 0x00, 0x00},
+    [GLYPH_CROSS]  = {0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x00, 0x00},
+    [GLYPH_BAR_1]  = {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10},
+    [GLYPH_BAR_2]  = {0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18},
+    [GLYPH_BAR_3]  = {0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C},
+    [GLYPH_BAR_4]  = {0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E},
+    [GLYPH_BAR_5]  = {0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F},
+};
+
+// Screen Templates
+// Blank cells on a template row double as the reserved slots for dynamic
+// fields such as the masked PIN; lcd_render patches them into the stream.
+static const lcd_template_t tmpl_main_menu = LCD_TEMPLATE("main", "  1: Unlock", "2: Settings 3:Exit");
+static const lcd_template_t tmpl_unlock = LCD_TEMPLATE("unlock", " Enter Password:", "");
+static const lcd_template_t tmpl_settings = LCD_TEMPLATE("settings", "  Settings Menu", "A:Master B:Guest C:Back");
+static const lcd_template_t tmpl_verify_master = LCD_TEMPLATE("verify", "Master Password:", "");
+static const lcd_template_t tmpl_new_master = LCD_TEMPLATE("new_master", "New Master Pass:", "");
+static const lcd_template_t tmpl_new_guest = LCD_TEMPLATE("new_guest", " New Guest Pass:", "");
+static const lcd_template_t tmpl_locked = LCD_TEMPLATE("locked", "  System Locked", "");
+static const lcd_template_t tmpl_access_granted = LCD_TEMPLATE("granted", "  Access Granted!", "");
+static const lcd_template_t tmpl_pass_used = LCD_TEMPLATE("pass_used", "  Pass Used!", "");
+static const lcd_template_t tmpl_guest_pass_used = LCD_TEMPLATE("guest_used", "  Guest Pass Used!", "");
+static const lcd_template_t tmpl_wrong_password = LCD_TEMPLATE("wrong", "  Wrong Password!", "");
+static const lcd_template_t tmpl_enter_new_pass = LCD_TEMPLATE("enter_new", "  Enter New Pass", "");
+static const lcd_template_t tmpl_pass_changed = LCD_TEMPLATE("changed", "  Pass Changed!", "");
+static const lcd_template_t tmpl_min_digits = LCD_TEMPLATE("min_digits", "  Min 4 digits!", "");
+static const lcd_template_t tmpl_pin_taken = LCD_TEMPLATE("pin_taken", "  PIN In Use!", "");
+static const lcd_template_t tmpl_system_unlocked = LCD_TEMPLATE("sys_unlocked", "System Unlocked", "");
+static const lcd_template_t tmpl_door_unlocked = LCD_TEMPLATE("door_unlocked", "  Door Unlocked", "");
+static const lcd_template_t tmpl_extend = LCD_TEMPLATE("extend", "Extend: Master", "");
+static const lcd_template_t tmpl_extended = LCD_TEMPLATE("extended", "Unlock Extended", "");
+static const lcd_template_t tmpl_max_window = LCD_TEMPLATE("max_window", "Max Time Reached", "");
+static const lcd_template_t tmpl_door_forced = LCD_TEMPLATE("door_forced", "  Door Forced!", "");
+static const lcd_template_t tmpl_cred_failed = LCD_TEMPLATE("cred_failed", "PIN Store Error", "Service Needed");
+static const lcd_template_t tmpl_try_later = LCD_TEMPLATE("try_later", "Too Many Tries!", "  Try Later");
+
+_Static_assert(LCD_TEMPLATE_BYTES <= LCD_BATCH_MAX * 4, "template must fit one batch");
+
 // Function Declarations
+static esp_err_t i2c_master_init(void);
+static void i2c_bus_clear(void);
+static void lcd_bus_record(esp_err_t err);
+static void lcd_bus_invalidate(void);
+static void lcd_bus_recover(void);
+static void lcd_encode(uint8_t *out, uint8_t value, uint8_t mode);
+static void lcd_batch_flush(lcd_batch_t *batch);
+static void lcd_batch_push(lcd_batch_t *batch, uint8_t value, uint8_t mode);
+static void lcd_batch_cmd(lcd_batch_t *batch, uint8_t cmd);
+static void lcd_batch_data(lcd_batch_t *batch, uint8_t data);
+static void lcd_batch_set_cursor(lcd_batch_t *batch, uint8_t col, uint8_t row);
+static void lcd_stats_begin_screen(void);
+static void lcd_stats_end_screen(const char *name);
 static void lcd_send_cmd(uint8_t cmd);
-static void lcd_send_data(uint8_t data);
 static void lcd_init(void);
-static void lcd_set_cursor(uint8_t col, uint8_t row);
-static void lcd_print_str(const char *str);
+static void lcd_frame_template(const lcd_template_t *tmpl);
+static void lcd_frame_put(uint8_t col, uint8_t row, char c);
+static void lcd_frame_bar(uint8_t row, uint32_t remaining, uint32_t total);
+static void lcd_frame_publish(void);
+static int lcd_diff_cost(const lcd_screen_t *screen);
+static void lcd_glyph_prepare(const lcd_screen_t *screen, lcd_batch_t *batch);
+static uint8_t lcd_cell_code(char cell);
+static void lcd_render(const lcd_screen_t *screen);
+static void lcd_marquee_start(const lcd_template_t *tmpl, lcd_batch_t *batch);
+static void lcd_marquee_stop(void);
+static void lcd_marquee_step(void);
+static TickType_t lcd_render_wait(void);
+static void lcd_render_timeout(void);
+static void lcd_show_message(const lcd_template_t *msg, uint32_t hold_ms);
+static void lcd_show_message_icon(const lcd_template_t *msg, lcd_glyph_t icon, uint32_t hold_ms);
+static void led_init(void);
+static void led_step_start(led_state_t *led);
+static void led_step_done(void *arg);
+static void led_play(led_id_t id, led_pattern_id_t pattern);
+static void effect_service(void);
+static TickType_t effect_wait(void);
+static void cred_derive(const char *pin, uint8_t *digest);
+static cred_entry_t *cred_entry(int id);
+static uint32_t cred_home(const uint8_t *digest);
+static bool cred_digest_equal(const uint8_t *a, const uint8_t *b);
+static int cred_find(const uint8_t *digest);
+static void cred_index_add(int id);
+static void cred_index_remove(int id);
+static void cred_index_rebuild(void);
+static int cred_insert(int id, const uint8_t *digest, cred_role_t role, uint16_t uses, uint32_t expires);
+static void cred_remove(int id);
+static const void *nvs_cache_record(nvs_field_t field, char *key, size_t *len);
+static uint32_t nvs_cache_crc_of(nvs_field_t field);
+static void nvs_cache_seed(nvs_field_t field);
+static void nvs_cache_mark(nvs_field_t field);
+static void nvs_cache_commit(bool now);
+static void nvs_cache_flush(void);
+static void nvs_cache_timer_callback(TimerHandle_t timer);
+static void nvs_cache_dump(void);
+static void cred_save(int id);
+static int cred_put(int id, const char *pin, cred_role_t role, uint16_t uses, uint32_t expires);
+static int cred_lookup(const char *pin);
+static bool cred_spent(int id);
+static void cred_consume(int id);
+static esp_err_t cred_table_load(void);
+static void cred_table_reset(void);
+static void console_cred_reset(void);
+static void cred_batch_save(void);
+static void cred_batch_load(void);
+static int cred_batch_apply(const cred_entry_t *entries, int n);
+static int cred_batch_add(cred_entry_t *entries, int n, const char *code, uint32_t valid_from, uint32_t expires);
+static int cred_batch_generate(cred_entry_t *entries, int n, int count, uint32_t valid_from, uint32_t expires);
+static void consumed_open(uint32_t batch_id);
+static bool consumed_test(int slot);
+static void consumed_mark(int slot);
+static void otp_load(void);
+static void otp_save(void);
+static uint32_t otp_code(mbedtls_md_context_t *ctx, uint64_t counter);
+static bool otp_totp_redeemed(uint32_t step);
+static bool otp_verify(const char *input);
+static void otp_set_secret(const uint8_t *secret);
+static void otp_console(void);
+static uint32_t rate_backoff_ms(uint8_t strikes);
+static void rate_refill(rate_bucket_t *bucket, int64_t now_ms);
+static void rate_seal(void);
+static void rate_save(void);
+static void rate_load(int64_t now_ms);
+static uint32_t rate_wait_ms(rate_channel_t channel, int64_t now_ms);
+static void rate_record(rate_channel_t channel, bool ok, int64_t now_ms);
+static bool rate_refuse(rate_channel_t channel);
+static void console_read_line(char *line, size_t len);
+static void console_provision(void);
+static void cred_legacy_pin(const char *key, const char *fallback, char *pin);
+static void cred_calibrate(void);
 static void load_passwords(void);
-static void save_passwords(void);
 static void hardware_init(void);
+static void lock_actuator_init(void);
+static void lock_actuator_duty(uint32_t pct);
+static void lock_actuator_account(int64_t now);
+static void lock_actuator_pull_in_done(void *arg);
+static void lock_actuator_engage(void);
+static void lock_actuator_release(void);
+static void relock_timer_callback(TimerHandle_t timer);
+static uint32_t lock_remaining_ms(void);
+static void door_isr_handler(void *arg);
+static bool door_sensor_open(void);
+static void door_sensor_arm(void);
+static void door_timer_callback(TimerHandle_t timer);
+static bool lock_extend(void);
 static void control_lock(bool unlock);
 static void display_menu(menu_state_t state);
 static void handle_keypress(char key);
+static void lat_record(lat_stage_t stage, int64_t us);
+static void lat_record_frame(lcd_screen_t *screen);
+static uint32_t lat_percentile(const lat_hist_t *hist, uint32_t pct);
+static void lat_dump(void);
+static void key_ring_publish(const keypad_event_t *event);
+static bool key_ring_full(void);
+static void key_ring_push(const keypad_event_t *event);
+static bool key_ring_pop(keypad_event_t *event);
+static void keypad_isr_handler(void *arg);
+static bool keypad_any_row_low(void);
+static void keypad_wait_for_press(void);
+static uint16_t keypad_sample(void);
+static bool keypad_debounce(uint16_t raw);
 void keypad_task(void *pvParameter);
+void lcd_render_task(void *pvParameter);
+void lat_console_task(void *pvParameter);
 void app_task(void *pvParameter);
 
-// LCD Functions
-static void lcd_send_cmd(uint8_t cmd) {
-    uint8_t data_u = (cmd & 0xF0) | LCD_BACKLIGHT;
-    uint8_t data_l = ((cmd << 4) & 0xF0) | LCD_BACKLIGHT;
-    
-    uint8_t buf[4];
-    buf[0] = data_u | 0x04;
-    buf[1] = data_u & ~0x04;
-    buf[2] = data_l | 0x04;
-    buf[3] = data_l & ~0x04;
-    
-    i2c_cmd_handle_t cmd_handle = i2c_cmd_link_create();
-    i2c_master_start(cmd_handle);
-    i2c_master_write_byte(cmd_handle, (LCD_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write(cmd_handle, buf, 4, true);
-    i2c_master_stop(cmd_handle);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(1000));
-    i2c_cmd_link_delete(cmd_handle);
+// LCD Batch Transport
+// Every HD44780 byte goes out as 4 PCF8574 bytes (high nibble then low nibble,
+// each strobed EN high/low). Queuing them in one buffer lets a whole line or
+// screen be written in a single I2C transaction instead of one per character.
+static void lcd_encode(uint8_t *out, uint8_t value, uint8_t mode) {
+    uint8_t data_u = (value & 0xF0) | LCD_BACKLIGHT | mode;
+    uint8_t data_l = ((value << 4) & 0xF0) | LCD_BACKLIGHT | mode;
+
+    out[0] = data_u | LCD_ENABLE;
+    out[1] = data_u & ~LCD_ENABLE;
+    out[2] = data_l | LCD_ENABLE;
+    out[3] = data_l & ~LCD_ENABLE;
 }
 
-static void lcd_send_data(uint8_t data) {
-    uint8_t data_u = (data & 0xF0) | LCD_BACKLIGHT | LCD_DATA;
-    uint8_t data_l = ((data << 4) & 0xF0) | LCD_BACKLIGHT | LCD_DATA;
-    
-    uint8_t buf[4];
-    buf[0] = data_u | 0x04;
-    buf[1] = data_u & ~0x04;
-    buf[2] = data_l | 0x04;
-    buf[3] = data_l & ~0x04;
-    
+static void lcd_batch_flush(lcd_batch_t *batch) {
+    if (batch->len == 0) {
+        return;
+    }
+    if (lcd_bus.state == LCD_BUS_DOWN) {
+        // Breaker open: drop the write, the panel is redrawn after recovery
+        batch->len = 0;
+        return;
+    }
+
     i2c_cmd_handle_t cmd_handle = i2c_cmd_link_create();
     i2c_master_start(cmd_handle);
     i2c_master_write_byte(cmd_handle, (LCD_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write(cmd_handle, buf, 4, true);
+    i2c_master_write(cmd_handle, batch->buf, batch->len, true);
     i2c_master_stop(cmd_handle);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(1000));
+    esp_err_t err = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
     i2c_cmd_link_delete(cmd_handle);
+    lcd_bus_record(err);
+
+    // Address byte + payload
+    lcd_stats.total_bytes += batch->len + 1;
+    lcd_stats.total_transactions++;
+    lcd_stats.screen_bytes += batch->len + 1;
+    lcd_stats.screen_transactions++;
+    batch->len = 0;
+}
+
+static void lcd_batch_push(lcd_batch_t *batch, uint8_t value, uint8_t mode) {
+    if (batch->len + 4 > sizeof(batch->buf)) {
+        lcd_batch_flush(batch);
+    }
+
+    lcd_encode(&batch->buf[batch->len], value, mode);
+    batch->len += 4;
+}
+
+static void lcd_batch_cmd(lcd_batch_t *batch, uint8_t cmd) {
+    lcd_batch_push(batch, cmd, LCD_COMMAND);
+}
+
+static void lcd_batch_data(lcd_batch_t *batch, uint8_t data) {
+    lcd_batch_push(batch, data, LCD_DATA);
+}
+
+static void lcd_batch_set_cursor(lcd_batch_t *batch, uint8_t col, uint8_t row) {
+    uint8_t row_offsets[] = {0x00, 0x40};
+    if (row >= LCD_ROWS) {
+        row = LCD_ROWS - 1;
+    }
+    lcd_batch_cmd(batch, LCD_SET_DDRAM_ADDR | (col + row_offsets[row]));
+}
+
+static void lcd_stats_begin_screen(void) {
+    lcd_stats.screen_bytes = 0;
+    lcd_stats.screen_transactions = 0;
+}
+
+static void lcd_stats_end_screen(const char *name) {
+    ESP_LOGD("LCD", "%s: %u bytes in %u transactions (total %u / %u)", name,
+             (unsigned)lcd_stats.screen_bytes, (unsigned)lcd_stats.screen_transactions,
+             (unsigned)lcd_stats.total_bytes, (unsigned)lcd_stats.total_transactions);
+}
+
+// LCD Bus Health
+// Every LCD transaction is recorded. Too many failures open the breaker:
+// writes are then dropped instead of each waiting out I2C_TIMEOUT_MS, and the
+// render task periodically clears the bus and re-initialises the panel.
+static void lcd_bus_record(esp_err_t err) {
+    lcd_bus.history <<= 1;
+    if (err == ESP_OK) {
+        lcd_bus.consecutive = 0;
+        return;
+    }
+
+    lcd_bus.history |= 1;
+    lcd_bus.consecutive++;
+    lcd_bus.errors++;
+    lcd_bus.last_error = err;
+
+    // Whatever was in flight may or may not have reached the panel
+    lcd_bus_invalidate();
+
+    if (lcd_bus.state == LCD_BUS_RECOVERING ||
+        lcd_bus.consecutive >= LCD_BUS_TRIP_CONSECUTIVE ||
+        __builtin_popcount(lcd_bus.history & ((1u << LCD_BUS_TRIP_WINDOW) - 1)) >= LCD_BUS_TRIP_FAILURES) {
+        if (lcd_bus.state == LCD_BUS_OK) {
+            lcd_bus.trips++;
+            lcd_bus.retry_ms = LCD_BUS_RETRY_MIN_MS;
+            lcd_bus.retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(lcd_bus.retry_ms);
+            ESP_LOGW("LCD", "Display bus down (%s), continuing without display", esp_err_to_name(err));
+        }
+        lcd_bus.state = LCD_BUS_DOWN;
+    }
+}
+
+// Forget what the panel shows so the next frame is drawn in full
+static void lcd_bus_invalidate(void) {
+    memset(lcd_shadow, LCD_CELL_STALE, sizeof(lcd_shadow));
+    for (int i = 0; i < LCD_CGRAM_SLOTS; i++) {
+        lcd_cgram[i].glyph = -1;
+        lcd_cgram[i].last_used = 0;
+    }
+    lcd_marquee.tmpl = NULL;
+    lcd_marquee.hidden = NULL;
+}
+
+// Standard I2C bus clear: with the driver released, clock SCL up to nine
+// times until a slave stuck mid-byte lets go of SDA, then issue a STOP.
+static void i2c_bus_clear(void) {
+    i2c_driver_delete(I2C_MASTER_NUM);
+
+    gpio_set_direction(I2C_MASTER_SDA_IO, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_direction(I2C_MASTER_SCL_IO, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_pull_mode(I2C_MASTER_SDA_IO, GPIO_PULLUP_ONLY);
+    gpio_set_pull_mode(I2C_MASTER_SCL_IO, GPIO_PULLUP_ONLY);
+    gpio_set_level(I2C_MASTER_SDA_IO, 1);
+    gpio_set_level(I2C_MASTER_SCL_IO, 1);
+    esp_rom_delay_us(5);
+
+    for (int i = 0; i < 9 && gpio_get_level(I2C_MASTER_SDA_IO) == 0; i++) {
+        gpio_set_level(I2C_MASTER_SCL_IO, 0);
+        esp_rom_delay_us(5);
+        gpio_set_level(I2C_MASTER_SCL_IO, 1);
+        esp_rom_delay_us(5);
+    }
+
+    gpio_set_level(I2C_MASTER_SCL_IO, 0);
+    esp_rom_delay_us(5);
+    gpio_set_level(I2C_MASTER_SDA_IO, 0);
+    esp_rom_delay_us(5);
+    gpio_set_level(I2C_MASTER_SCL_IO, 1);
+    esp_rom_delay_us(5);
+    gpio_set_level(I2C_MASTER_SDA_IO, 1);
+    esp_rom_delay_us(5);
+}
+
+// Runs on the render task while the breaker is open
+static void lcd_bus_recover(void) {
+    ESP_LOGI("LCD", "Display bus recovery attempt (%u errors, %u trips)",
+             (unsigned)lcd_bus.errors, (unsigned)lcd_bus.trips);
+
+    i2c_bus_clear();
+    lcd_bus.state = LCD_BUS_RECOVERING;
+    lcd_bus.consecutive = 0;
+    lcd_bus.history = 0;
+    if (i2c_master_init() == ESP_OK) {
+        lcd_init();
+    } else {
+        lcd_bus.state = LCD_BUS_DOWN;
+    }
+
+    if (lcd_bus.state == LCD_BUS_DOWN) {
+        lcd_bus.retry_ms *= 2;
+        if (lcd_bus.retry_ms > LCD_BUS_RETRY_MAX_MS) {
+            lcd_bus.retry_ms = LCD_BUS_RETRY_MAX_MS;
+        }
+        lcd_bus.retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(lcd_bus.retry_ms);
+        return;
+    }
+
+    lcd_bus.state = LCD_BUS_OK;
+    lcd_bus.recoveries++;
+    ESP_LOGI("LCD", "Display bus recovered");
+    if (lcd_last.tmpl) {
+        lcd_render(&lcd_last);
+    }
+}
+
+// LCD Functions
+static void lcd_send_cmd(uint8_t cmd) {
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_cmd(&batch, cmd);
+    lcd_batch_flush(&batch);
 }
 
 static void lcd_init(void) {
@@ -156,186 +999,1687 @@ static void lcd_init(void) {
     lcd_send_cmd(LCD_CLEAR_DISPLAY);
     vTaskDelay(pdMS_TO_TICKS(2));
     lcd_send_cmd(LCD_ENTRY_MODE_SET | 0x02);
+
+    lcd_marquee.tmpl = NULL;
+    lcd_marquee.hidden = NULL;
+    lcd_marquee.offset = 0;
+    if (lcd_bus.state == LCD_BUS_DOWN) {
+        lcd_bus_invalidate();
+        return;
+    }
+
+    // Panel is blank now, keep the shadow in step with it. CGRAM content
+    // is undefined after power-up, so every glyph has to be reloaded.
+    memset(lcd_shadow, ' ', sizeof(lcd_shadow));
+    for (int i = 0; i < LCD_CGRAM_SLOTS; i++) {
+        lcd_cgram[i].glyph = -1;
+        lcd_cgram[i].last_used = 0;
+    }
 }
 
-static void lcd_set_cursor(uint8_t col, uint8_t row) {
-    uint8_t row_offsets[] = {0x00, 0x40};
-    if (row >= LCD_ROWS) {
-        row = LCD_ROWS - 1;
+// LCD Framebuffer
+// Screens are composed into lcd_frame by the state machine and published to
+// lcd_render_task, which compares them against lcd_shadow (a mirror of the
+// panel). Small changes send only the differing cells, with a cursor move
+// whenever the next changed cell is not where the address counter already
+// points. Full screen changes send the template's pre-encoded stream as is,
+// so steady-state redraws never need LCD_CLEAR_DISPLAY.
+static void lcd_frame_template(const lcd_template_t *tmpl) {
+    memcpy(lcd_frame.cells, tmpl->cells, sizeof(lcd_frame.cells));
+    lcd_frame.tmpl = tmpl;
+}
+
+static void lcd_frame_put(uint8_t col, uint8_t row, char c) {
+    if (col < LCD_COLUMNS && row < LCD_ROWS) {
+        lcd_frame.cells[row][col] = c;
     }
-    lcd_send_cmd(LCD_SET_DDRAM_ADDR | (col + row_offsets[row]));
 }
 
-static void lcd_print_str(const char *str) {
-    while (*str) {
-        lcd_send_data(*str++);
+// Progress bar across a whole row, 5 pixel columns per cell
+static void lcd_frame_bar(uint8_t row, uint32_t remaining, uint32_t total) {
+    uint32_t filled = (remaining * LCD_COLUMNS * 5 + total - 1) / total;
+    for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+        uint32_t start = col * 5;
+        if (filled <= start) {
+            lcd_frame_put(col, row, ' ');
+        } else if (filled - start >= 5) {
+            lcd_frame_put(col, row, LCD_GLYPH(GLYPH_BAR_5));
+        } else {
+            lcd_frame_put(col, row, LCD_GLYPH(GLYPH_BAR_1 + filled - start - 1));
+        }
     }
 }
 
-// Password Management
-static void load_passwords(void) {
-    size_t required_size = sizeof(lock_system.master_password);
-    esp_err_t err = nvs_get_blob(nvs_handler, "master_password", lock_system.master_password, &required_size);
-    
-    if (err == ESP_ERR_NVS_NOT_FOUND || required_size == 0) {
-        strcpy(lock_system.master_password, "1234");
-        save_passwords();
+// Hand the composed frame to the render task without waiting on the bus.
+// The queue holds one frame, so a newer frame replaces one not yet drawn.
+static void lcd_frame_publish(void) {
+    // Only the first frame after a key is timed against it
+    lcd_frame.key_onset_us = lat_key_onset_us;
+    lcd_frame.published_us = esp_timer_get_time();
+    lat_key_onset_us = 0;
+    xQueueOverwrite(lcd_queue, &lcd_frame);
+}
+
+// HD44780 bytes needed to bring the panel from lcd_shadow to this frame
+static int lcd_diff_cost(const lcd_screen_t *screen) {
+    int cost = 0;
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        int cursor = -1;
+        for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+            if (screen->cells[row][col] != lcd_shadow[row][col]) {
+                cost += (cursor != col) ? 2 : 1;
+                cursor = col + 1;
+            }
+        }
     }
-    
-    required_size = sizeof(lock_system.guest_password);
-    err = nvs_get_blob(nvs_handler, "guest_password", lock_system.guest_password, &required_size);
-    
-    if (err == ESP_ERR_NVS_NOT_FOUND || required_size == 0) {
-        strcpy(lock_system.guest_password, "5678");
-        save_passwords();
+    return cost;
+}
+
+// Glyph Cache
+// Makes every glyph used by the frame resident in CGRAM before it is drawn.
+// Missing glyphs take a free slot, or else the least recently used slot whose
+// glyph this frame does not need. Cells on the panel still showing an evicted
+// glyph are marked stale in the shadow so the diff redraws them.
+static void lcd_glyph_prepare(const lcd_screen_t *screen, lcd_batch_t *batch) {
+    uint32_t needed = 0;
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+            if (LCD_IS_GLYPH(screen->cells[row][col])) {
+                needed |= 1u << ((uint8_t)screen->cells[row][col] - LCD_GLYPH_BASE);
+            }
+        }
+    }
+    if (needed == 0) {
+        return;
+    }
+
+    lcd_cgram_clock++;
+    for (int i = 0; i < LCD_CGRAM_SLOTS; i++) {
+        if (lcd_cgram[i].glyph >= 0 && (needed & (1u << lcd_cgram[i].glyph))) {
+            lcd_cgram[i].last_used = lcd_cgram_clock;
+            needed &= ~(1u << lcd_cgram[i].glyph);
+        }
+    }
+
+    for (int glyph = 0; glyph < GLYPH_COUNT && needed; glyph++) {
+        if (!(needed & (1u << glyph))) {
+            continue;
+        }
+
+        int victim = 0;
+        for (int i = 1; i < LCD_CGRAM_SLOTS; i++) {
+            if (lcd_cgram[i].last_used < lcd_cgram[victim].last_used) {
+                victim = i;
+            }
+        }
+        if (lcd_cgram[victim].last_used == lcd_cgram_clock) {
+            ESP_LOGW("LCD", "More than %d glyphs on one screen", LCD_CGRAM_SLOTS);
+            return;
+        }
+
+        if (lcd_cgram[victim].glyph >= 0) {
+            char evicted = LCD_GLYPH(lcd_cgram[victim].glyph);
+            for (uint8_t row = 0; row < LCD_ROWS; row++) {
+                for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+                    if (lcd_shadow[row][col] == evicted) {
+                        lcd_shadow[row][col] = LCD_CELL_STALE;
+                    }
+                }
+            }
+        }
+
+        lcd_batch_cmd(batch, LCD_SET_CGRAM_ADDR | (victim << 3));
+        for (int r = 0; r < 8; r++) {
+            lcd_batch_data(batch, lcd_glyph_rows[glyph][r]);
+        }
+        lcd_cgram[victim].glyph = glyph;
+        lcd_cgram[victim].last_used = lcd_cgram_clock;
+        lcd_cgram_loads++;
+        needed &= ~(1u << glyph);
     }
+}
 
-    // Load guest password usage status
-    err = nvs_get_u8(nvs_handler, "guest_used", (uint8_t*)&lock_system.guest_password_used);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        lock_system.guest_password_used = false;
-        nvs_set_u8(nvs_handler, "guest_used", lock_system.guest_password_used);
-        nvs_commit(nvs_handler);
+// Byte to write to DDRAM for a frame cell
+static uint8_t lcd_cell_code(char cell) {
+    if (LCD_IS_GLYPH(cell)) {
+        for (int i = 0; i < LCD_CGRAM_SLOTS; i++) {
+            if (lcd_cgram[i].glyph == (uint8_t)cell - LCD_GLYPH_BASE) {
+                return i;
+            }
+        }
+        return ' ';
     }
+    return (uint8_t)cell;
 }
 
-static void save_passwords(void) {
-    nvs_set_blob(nvs_handler, "master_password", lock_system.master_password, sizeof(lock_system.master_password));
-    nvs_set_blob(nvs_handler, "guest_password", lock_system.guest_password, sizeof(lock_system.guest_password));
-    nvs_set_u8(nvs_handler, "guest_used", lock_system.guest_password_used);
-    nvs_commit(nvs_handler);
+static void lcd_render(const lcd_screen_t *screen) {
+    const lcd_template_t *tmpl = screen->tmpl;
+    lcd_batch_t batch = { .len = 0 };
+
+    // Display down: lcd_last is drawn once the bus has recovered
+    if (lcd_bus.state == LCD_BUS_DOWN) {
+        return;
+    }
+
+    // Same scrolling screen republished unchanged: let it keep scrolling
+    if (lcd_marquee.tmpl == tmpl && lcd_diff_cost(screen) == 0) {
+        return;
+    }
+
+    lcd_stats_begin_screen();
+    lcd_marquee_stop();
+
+    // CGRAM writes go first and share the transaction with the redraw
+    lcd_glyph_prepare(screen, &batch);
+
+    if (lcd_diff_cost(screen) >= LCD_TEMPLATE_BYTES / 4) {
+        // Rewriting everything anyway: copy the pre-encoded stream and only
+        // encode the reserved slots that differ from the template text
+        if (batch.len + LCD_TEMPLATE_BYTES > sizeof(batch.buf)) {
+            lcd_batch_flush(&batch);
+        }
+        uint8_t *stream = &batch.buf[batch.len];
+        memcpy(stream, tmpl->stream, LCD_TEMPLATE_BYTES);
+        batch.len += LCD_TEMPLATE_BYTES;
+        for (uint8_t row = 0; row < LCD_ROWS; row++) {
+            for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+                if (screen->cells[row][col] != tmpl->cells[row][col]) {
+                    lcd_encode(&stream[(row * (LCD_COLUMNS + 1) + col + 1) * 4],
+                               lcd_cell_code(screen->cells[row][col]), LCD_DATA);
+                }
+            }
+        }
+        memcpy(lcd_shadow, screen->cells, sizeof(lcd_shadow));
+    } else {
+        for (uint8_t row = 0; row < LCD_ROWS; row++) {
+            int cursor = -1;  // Column the address counter points at, -1 if unknown
+            for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+                if (screen->cells[row][col] == lcd_shadow[row][col]) {
+                    continue;
+                }
+                if (cursor != col) {
+                    lcd_batch_set_cursor(&batch, col, row);
+                }
+                lcd_batch_data(&batch, lcd_cell_code(screen->cells[row][col]));
+                lcd_shadow[row][col] = screen->cells[row][col];
+                cursor = col + 1;
+            }
+        }
+    }
+
+    lcd_marquee_start(tmpl, &batch);
+    lcd_batch_flush(&batch);
+    lcd_stats_end_screen(tmpl->name);
 }
 
-// Hardware Initialization
-static void hardware_init(void) {
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
+// Marquee
+// Over-length lines are written into DDRAM once, past the visible columns,
+// and then scrolled with the display shift command from the render task's
+// timeout: one command byte per step instead of a line rewrite. The HD44780
+// shifts both lines together, so the shorter line is padded with spaces.
+static void lcd_marquee_start(const lcd_template_t *tmpl, lcd_batch_t *batch) {
+    uint8_t length = 0;
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        size_t len = strlen(tmpl->text[row]);
+        if (len > length) {
+            length = (len > LCD_DDRAM_LINE) ? LCD_DDRAM_LINE : len;
+        }
+    }
+    if (length <= LCD_COLUMNS) {
+        return;
     }
-    ESP_ERROR_CHECK(ret);
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &nvs_handler));
 
-    // Initialize lock pin
-    gpio_reset_pin(LOCK_PIN);
-    gpio_set_direction(LOCK_PIN, GPIO_MODE_OUTPUT);
-    gpio_set_level(LOCK_PIN, 0);                                                     // i change this also
+    // Columns below LCD_COLUMNS are already on the panel via the frame, and
+    // the rest survive redraws of the same screen. PIN entry screens fit in
+    // LCD_COLUMNS so the digits being typed never scroll away.
+    if (lcd_marquee.hidden != tmpl) {
+        for (uint8_t row = 0; row < LCD_ROWS; row++) {
+            const char *text = tmpl->text[row];
+            size_t len = strlen(text);
+            lcd_batch_set_cursor(batch, LCD_COLUMNS, row);
+            for (uint8_t col = LCD_COLUMNS; col < length; col++) {
+                lcd_batch_data(batch, col < len ? text[col] : ' ');
+            }
+        }
+        lcd_marquee.hidden = tmpl;
+    }
+
+    lcd_marquee.tmpl = tmpl;
+    lcd_marquee.length = length;
+    lcd_marquee.offset = 0;
+    lcd_marquee.backwards = false;
+    lcd_marquee.pause = LCD_MARQUEE_PAUSE_STEPS;
+}
+
+static void lcd_marquee_stop(void) {
+    if (lcd_marquee.tmpl == NULL) {
+        return;
+    }
+    if (lcd_marquee.offset != 0) {
+        lcd_send_cmd(LCD_RETURN_HOME);
+        vTaskDelay(pdMS_TO_TICKS(2));
+    }
+    lcd_marquee.tmpl = NULL;
+    lcd_marquee.offset = 0;
+}
+
+static void lcd_marquee_step(void) {
+    if (lcd_marquee.pause > 0) {
+        lcd_marquee.pause--;
+        return;
+    }
+
+    if (lcd_marquee.backwards) {
+        lcd_send_cmd(LCD_CURSOR_SHIFT | LCD_DISPLAY_MOVE | LCD_MOVE_RIGHT);
+        lcd_marquee.offset--;
+    } else {
+        lcd_send_cmd(LCD_CURSOR_SHIFT | LCD_DISPLAY_MOVE);
+        lcd_marquee.offset++;
+    }
+
+    if (lcd_marquee.offset == 0 || lcd_marquee.offset == lcd_marquee.length - LCD_COLUMNS) {
+        lcd_marquee.backwards = !lcd_marquee.backwards;
+        lcd_marquee.pause = LCD_MARQUEE_PAUSE_STEPS;
+    }
+}
+
+// Status message screen, held for hold_ms while display_menu() keeps
+// updating lock_system in the background; the menu returns when it expires
+static void lcd_show_message(const lcd_template_t *msg, uint32_t hold_ms) {
+    lcd_frame_template(msg);
+    lcd_frame_publish();
+    effect_message_held = true;
+    effect_message_until = xTaskGetTickCount() + pdMS_TO_TICKS(hold_ms);
+}
+
+static void lcd_show_message_icon(const lcd_template_t *msg, lcd_glyph_t icon, uint32_t hold_ms) {
+    lcd_frame_template(msg);
+    lcd_frame_put(0, 0, LCD_GLYPH(icon));
+    lcd_frame_publish();
+    effect_message_held = true;
+    effect_message_until = xTaskGetTickCount() + pdMS_TO_TICKS(hold_ms);
+}
+
+// NVS Write Cache
+// Owners mark the records they changed and end each save with
+// nvs_cache_commit(). Routine saves (PIN changes, first boot) wait on
+// nvs_cache_timer so a burst of them shares one commit; saves that must
+// survive a power cut (used PINs, redeemed codes, lockout strikes) flush at
+// once, taking anything pending with them. A flush writes only records whose
+// CRC differs from what NVS holds, so a guest unlock rewrites its chunk but
+// not the unchanged header. Runs on app_task, and at shutdown.
+static const void *nvs_cache_record(nvs_field_t field, char *key, size_t *len) {
+    switch (field) {
+        case NVS_FIELD_CRED_HDR:
+            strcpy(key, "cred_hdr");
+            *len = sizeof(cred_hdr);
+            return &cred_hdr;
+        case NVS_FIELD_CRED_BATCH:
+            strcpy(key, "cred_batch");
+            *len = offsetof(cred_batch_t, entries) + cred_batch.count * sizeof(cred_entry_t);
+            return &cred_batch;
+        case NVS_FIELD_OTP_SECRET:
+            strcpy(key, "otp_secret");
+            *len = sizeof(otp_secret);
+            return otp_secret;
+        case NVS_FIELD_OTP_STATE:
+            strcpy(key, "otp_state");
+            *len = sizeof(otp_state);
+            return &otp_state;
+        case NVS_FIELD_RATE_STATE:
+            strcpy(key, "rate_state");
+            *len = sizeof(rate_saved);
+            return rate_saved;
+        case NVS_FIELD_CONSUMED:
+            strcpy(key, "consumed");
+            *len = sizeof(consumed_bits);
+            return consumed_bits;
+        default: {
+            int chunk = field - NVS_FIELD_CRED_CHUNK;
+            int n = cred_hdr.used - chunk * CRED_NVS_CHUNK;
+            if (n > CRED_NVS_CHUNK) {
+                n = CRED_NVS_CHUNK;
+            }
+            snprintf(key, 16, "cred_%d", chunk);
+            *len = n > 0 ? n * sizeof(cred_entry_t) : 0;
+            return &cred_entries[chunk * CRED_NVS_CHUNK];
+        }
+    }
+}
+
+// Length and contents, never 0 so that 0 can mean unknown
+static uint32_t nvs_cache_crc_of(nvs_field_t field) {
+    char key[16];
+    size_t len;
+    const void *data = nvs_cache_record(field, key, &len);
+    uint32_t len32 = len;
+
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&len32, sizeof(len32));
+    crc = esp_rom_crc32_le(crc, data, len);
+    return crc ? crc : 1;
+}
+
+// Records a field just read from NVS as clean
+static void nvs_cache_seed(nvs_field_t field) {
+    nvs_cache_crc[field] = nvs_cache_crc_of(field);
+}
+
+static void nvs_cache_mark(nvs_field_t field) {
+    nvs_cache_dirty[field / 32] |= 1u << (field % 32);
+    nvs_cache_stats.marks++;
+}
+
+static void nvs_cache_commit(bool now) {
+    nvs_cache_stats.saves++;
+    if (now) {
+        nvs_cache_flush();
+    } else if (!xTimerIsTimerActive(nvs_cache_timer)) {
+        xTimerChangePeriod(nvs_cache_timer, pdMS_TO_TICKS(NVS_CACHE_DEFER_MS), 0);  // Also starts it
+    }
+}
+
+// A record stays dirty until both its nvs_set_blob and the commit after it
+// succeed; anything left dirty is retried after NVS_CACHE_DEFER_MS
+static void nvs_cache_flush(void) {
+    int64_t start = esp_timer_get_time();
+    uint32_t written[(NVS_FIELD_COUNT + 31) / 32] = { 0 };
+    uint32_t writes = 0, bytes = 0;
+    bool failed = false;
+    char key[16];
+    size_t len;
+
+    for (int field = 0; field < NVS_FIELD_COUNT; field++) {
+        uint32_t bit = 1u << (field % 32);
+        if (!(nvs_cache_dirty[field / 32] & bit)) {
+            continue;
+        }
+        uint32_t crc = nvs_cache_crc_of(field);
+        if (crc == nvs_cache_crc[field]) {
+            nvs_cache_dirty[field / 32] &= ~bit;
+            nvs_cache_stats.skipped++;
+            continue;
+        }
+        const void *data = nvs_cache_record(field, key, &len);
+        esp_err_t err = nvs_set_blob(nvs_handler, key, data, len);
+        if (err != ESP_OK) {
+            ESP_LOGE("NVS", "Writing %s failed (%d)", key, err);
+            nvs_cache_crc[field] = 0;
+            failed = true;
+            continue;
+        }
+        nvs_cache_dirty[field / 32] &= ~bit;
+        nvs_cache_crc[field] = crc;
+        written[field / 32] |= bit;
+        writes++;
+        bytes += len;
+    }
+    if (writes > 0) {
+        esp_err_t err = nvs_commit(nvs_handler);
+        if (err == ESP_OK) {
+            nvs_cache_stats.writes += writes;
+            nvs_cache_stats.bytes += bytes;
+            nvs_cache_stats.commits++;
+        } else {
+            // Whether any of it reached flash is unknown: write it all again
+            ESP_LOGE("NVS", "Commit failed (%d)", err);
+            for (int field = 0; field < NVS_FIELD_COUNT; field++) {
+                if (written[field / 32] & (1u << (field % 32))) {
+                    nvs_cache_dirty[field / 32] |= 1u << (field % 32);
+                    nvs_cache_crc[field] = 0;
+                }
+            }
+            writes = 0;
+            failed = true;
+        }
+    }
+    if (failed) {
+        nvs_cache_stats.failures++;
+        xTimerChangePeriod(nvs_cache_timer, pdMS_TO_TICKS(NVS_CACHE_DEFER_MS), 0);
+    }
+    if (writes == 0) {
+        return;
+    }
+
+    int64_t us = esp_timer_get_time() - start;
+    nvs_cache_stats.flush_us += us;
+    if (us > nvs_cache_stats.flush_us_max) {
+        nvs_cache_stats.flush_us_max = us;
+    }
+}
+
+// Timer service task: the flush itself runs on app_task
+static void nvs_cache_timer_callback(TimerHandle_t timer) {
+    xTaskNotify(app_task_handle, APP_NOTIFY_NVS_FLUSH, eSetBits);
+}
+
+// Console 'n'
+static void nvs_cache_dump(void) {
+    const nvs_cache_stats_t *st = &nvs_cache_stats;
+
+    ESP_LOGI("NVS", "Saved %u records at %u save points; wrote %u (%u unchanged skipped, %u bytes) in %u commits, %u failed",
+             (unsigned)st->marks, (unsigned)st->saves, (unsigned)st->writes, (unsigned)st->skipped,
+             (unsigned)st->bytes, (unsigned)st->commits, (unsigned)st->failures);
+    ESP_LOGI("NVS", "Flush time avg %u us, max %u us",
+             (unsigned)(st->commits ? st->flush_us / st->commits : 0), (unsigned)st->flush_us_max);
+}
+
+// Credential Table
+// cred_entries is indexed by an open-addressing table keyed on each PIN's
+// digest, with linear probing and backward-shift deletion (no tombstones).
+static void cred_derive(const char *pin, uint8_t *digest) {
+    mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA256, (const unsigned char *)pin, strlen(pin),
+                                  cred_hdr.salt, CRED_SALT_LEN, cred_hdr.iterations, CRED_DIGEST_LEN, digest);
+}
+
+static cred_entry_t *cred_entry(int id) {
+    return (id < CRED_TABLE_MAX) ? &cred_entries[id] : &cred_batch.entries[id - CRED_TABLE_MAX];
+}
+
+static uint32_t cred_home(const uint8_t *digest) {
+    uint32_t h;
+    memcpy(&h, digest, sizeof(h));
+    return h & (CRED_INDEX_SIZE - 1);
+}
+
+// Always compares every byte, so the time taken does not depend on where
+// the digests differ
+static bool cred_digest_equal(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+    for (int i = 0; i < CRED_DIGEST_LEN; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// Id holding digest, or -1. Ends at the first empty slot, which exists
+// because the index is at most half full.
+static int cred_find(const uint8_t *digest) {
+    for (uint32_t slot = cred_home(digest);; slot = (slot + 1) & (CRED_INDEX_SIZE - 1)) {
+        uint16_t ref = cred_index[slot];
+        if (ref == 0) {
+            return -1;
+        }
+        if (cred_digest_equal(cred_entry(ref - 1)->digest, digest)) {
+            return ref - 1;
+        }
+    }
+}
+
+static void cred_index_add(int id) {
+    uint32_t slot = cred_home(cred_entry(id)->digest);
+    while (cred_index[slot]) {
+        slot = (slot + 1) & (CRED_INDEX_SIZE - 1);
+    }
+    cred_index[slot] = id + 1;
+}
+
+static void cred_index_remove(int id) {
+    const uint32_t mask = CRED_INDEX_SIZE - 1;
+    uint32_t hole = cred_home(cred_entry(id)->digest);
+
+    while (cred_index[hole] != id + 1) {
+        hole = (hole + 1) & mask;
+    }
+    // Pull back each later entry of the run whose home is not in (hole, slot]
+    for (uint32_t slot = (hole + 1) & mask; cred_index[slot]; slot = (slot + 1) & mask) {
+        uint32_t home = cred_home(cred_entry(cred_index[slot] - 1)->digest);
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            cred_index[hole] = cred_index[slot];
+            hole = slot;
+        }
+    }
+    cred_index[hole] = 0;
+}
+
+static void cred_index_rebuild(void) {
+    memset(cred_index, 0, sizeof(cred_index));
+    for (int id = 0; id < cred_hdr.used; id++) {
+        if (cred_entries[id].role != CRED_ROLE_NONE) {
+            cred_index_add(id);
+        }
+    }
+    for (int i = 0; i < cred_batch.count; i++) {
+        if (cred_batch.entries[i].role != CRED_ROLE_NONE) {
+            cred_index_add(CRED_TABLE_MAX + i);
+        }
+    }
+}
+
+// Stores a digest at id (-1 allocates one) in RAM only. Returns the id, or -1
+// if the table is full or another id already has this PIN.
+static int cred_insert(int id, const uint8_t *digest, cred_role_t role, uint16_t uses, uint32_t expires) {
+    int owner = cred_find(digest);
+
+    if (owner >= 0 && owner != id) {
+        return -1;
+    }
+    if (id < 0) {
+        // Ids up to CRED_ID_GUEST are kept for the settings menu, even while empty
+        int holes = cred_hdr.used - cred_hdr.count;
+        for (int i = CRED_ID_MASTER; i <= CRED_ID_GUEST && i < cred_hdr.used; i++) {
+            holes -= cred_entries[i].role == CRED_ROLE_NONE;
+        }
+        id = cred_hdr.used > CRED_ID_GUEST ? cred_hdr.used : CRED_ID_GUEST + 1;
+        for (int i = CRED_ID_GUEST + 1; holes > 0 && i < cred_hdr.used; i++) {
+            if (cred_entries[i].role == CRED_ROLE_NONE) {
+                id = i;  // Reuse a removed id before growing
+                break;
+            }
+        }
+    }
+    if (id >= CRED_TABLE_MAX) {
+        return -1;
+    }
+
+    if (cred_entries[id].role != CRED_ROLE_NONE) {
+        cred_index_remove(id);
+        cred_hdr.count--;
+    }
+    memcpy(cred_entries[id].digest, digest, CRED_DIGEST_LEN);
+    cred_entries[id].valid_from = 0;
+    cred_entries[id].expires = expires;
+    cred_entries[id].uses_left = uses;
+    cred_entries[id].role = role;
+    cred_entries[id].reserved = 0;
+    cred_index_add(id);
+    cred_hdr.count++;
+    if (id >= cred_hdr.used) {
+        cred_hdr.used = id + 1;
+    }
+    return id;
+}
+
+// Batch entries keep their place, so the batch count does not change
+static void cred_remove(int id) {
+    cred_entry_t *entry = cred_entry(id);
+
+    if (entry->role == CRED_ROLE_NONE) {
+        return;
+    }
+    cred_index_remove(id);
+    memset(entry, 0, sizeof(*entry));
+    if (id < CRED_TABLE_MAX) {
+        cred_hdr.count--;
+    }
+}
+
+// Marks the chunk holding id and the header for writing, or the courier
+// batch; the caller decides when they are committed
+static void cred_save(int id) {
+    if (id >= CRED_TABLE_MAX) {
+        nvs_cache_mark(NVS_FIELD_CRED_BATCH);
+        return;
+    }
+    nvs_cache_mark(NVS_FIELD_CRED_CHUNK + id / CRED_NVS_CHUNK);
+    nvs_cache_mark(NVS_FIELD_CRED_HDR);
+}
+
+static int cred_put(int id, const char *pin, cred_role_t role, uint16_t uses, uint32_t expires) {
+    uint8_t digest[CRED_DIGEST_LEN];
+
+    cred_derive(pin, digest);
+    id = cred_insert(id, digest, role, uses, expires);
+    if (id >= 0) {
+        cred_save(id);
+        nvs_cache_commit(false);
+    }
+    return id;
+}
+
+// Id of the credential for pin, or -1. Expired entries are removed when
+// they are next presented. Entries with a validity window are refused until
+// the clock has been set (e.g. by SNTP), since neither bound can be checked.
+static int cred_lookup(const char *pin) {
+    uint8_t digest[CRED_DIGEST_LEN];
+    uint32_t now = time(NULL);
+
+    cred_derive(pin, digest);
+    int id = cred_find(digest);
+    if (id < 0) {
+        return -1;
+    }
+    if ((cred_entry(id)->expires || cred_entry(id)->valid_from) && now < OTP_CLOCK_VALID) {
+        ESP_LOGW("CRED", "Credential %d refused, clock not set", id);
+        return -1;
+    }
+    if (cred_entry(id)->expires && now >= cred_entry(id)->expires) {
+        ESP_LOGI("CRED", "Credential %d expired", id);
+        if (id < CRED_TABLE_MAX) {
+            cred_remove(id);  // Batch entries stay until the batch is replaced
+            cred_save(id);
+            nvs_cache_commit(false);
+        }
+        return -1;
+    }
+    if (now < cred_entry(id)->valid_from) {
+        ESP_LOGI("CRED", "Credential %d not valid yet", id);
+        return -1;
+    }
+    return id;
+}
+
+static bool cred_spent(int id) {
+    if (id >= CRED_TABLE_MAX) {
+        return consumed_test(id - CRED_TABLE_MAX);
+    }
+    return cred_entries[id].uses_left == 0;
+}
+
+// Courier codes are marked in the consumed bitmap; table entries count down
+static void cred_consume(int id) {
+    cred_entry_t *entry = cred_entry(id);
+
+    if (id >= CRED_TABLE_MAX) {
+        consumed_mark(id - CRED_TABLE_MAX);
+    } else if (entry->uses_left != CRED_USES_UNLIMITED && entry->uses_left > 0) {
+        entry->uses_left--;
+        cred_save(id);
+        nvs_cache_commit(true);  // A power cut must not give the use back
+    }
+}
+
+// ESP_ERR_NVS_NOT_FOUND only when there is no table at all; anything else
+// that fails means a table exists but cannot be trusted
+static esp_err_t cred_table_load(void) {
+    char key[16];
+    size_t size = sizeof(cred_hdr);
+    esp_err_t err = nvs_get_blob(nvs_handler, "cred_hdr", &cred_hdr, &size);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (size != sizeof(cred_hdr) || cred_hdr.used > CRED_TABLE_MAX || cred_hdr.count > cred_hdr.used) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (int chunk = 0; chunk * CRED_NVS_CHUNK < cred_hdr.used; chunk++) {
+        snprintf(key, sizeof(key), "cred_%d", chunk);
+        size = CRED_NVS_CHUNK * sizeof(cred_entry_t);
+        err = nvs_get_blob(nvs_handler, key, &cred_entries[chunk * CRED_NVS_CHUNK], &size);
+        if (err == ESP_OK && size % sizeof(cred_entry_t) != 0) {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE("CRED", "Reading %s failed (%d)", key, err);
+            return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_INVALID_STATE : err;
+        }
+        nvs_cache_seed(NVS_FIELD_CRED_CHUNK + chunk);
+    }
+    nvs_cache_seed(NVS_FIELD_CRED_HDR);
+    cred_batch_load();
+    consumed_open(cred_batch.id);
+    cred_index_rebuild();
+    return ESP_OK;
+}
+
+// A new table: plaintext PINs from the oldest firmware move in, with the
+// guest's "guest_used" flag; an id without one gets the default PIN
+static void cred_table_reset(void) {
+    uint8_t guest_used = 0;
+    char pin[6];
+
+    memset(&cred_hdr, 0, sizeof(cred_hdr));
+    memset(cred_entries, 0, sizeof(cred_entries));
+    memset(cred_index, 0, sizeof(cred_index));
+    esp_fill_random(cred_hdr.salt, CRED_SALT_LEN);
+    cred_hdr.iterations = CRED_KDF_ITERATIONS;
+    cred_batch_load();
+    consumed_open(cred_batch.id);
+    cred_index_rebuild();
+
+    cred_legacy_pin("master_password", "1234", pin);
+    cred_put(CRED_ID_MASTER, pin, CRED_ROLE_MASTER, CRED_USES_UNLIMITED, 0);
+    nvs_get_u8(nvs_handler, "guest_used", &guest_used);
+    cred_legacy_pin("guest_password", "5678", pin);
+    cred_put(CRED_ID_GUEST, pin, CRED_ROLE_GUEST, guest_used ? 0 : 1, 0);
+    nvs_erase_key(nvs_handler, "guest_used");
+    memset(pin, 0, sizeof(pin));
+    nvs_cache_flush();                    // One commit for everything the reset wrote
+    cred_table_failed = false;
+}
+
+// Courier Code Batch
+// A week of one-time courier codes is provisioned over the console in one
+// go. The batch replaces the previous one and is written as a single packed,
+// checksummed blob with one commit; its entries share cred_index with the
+// table, so lookups stay one probe.
+static void cred_batch_save(void) {
+    cred_batch.crc = esp_rom_crc32_le(0, (const uint8_t *)cred_batch.entries, cred_batch.count * sizeof(cred_entry_t));
+    nvs_cache_mark(NVS_FIELD_CRED_BATCH);
+    nvs_cache_commit(true);
+}
+
+static void cred_batch_load(void) {
+    size_t size = sizeof(cred_batch);
+
+    if (nvs_get_blob(nvs_handler, "cred_batch", &cred_batch, &size) != ESP_OK) {
+        cred_batch.count = 0;
+        cred_batch.id = 0;
+        return;
+    }
+    if (size < offsetof(cred_batch_t, entries) || cred_batch.count > CRED_BATCH_MAX ||
+        size != offsetof(cred_batch_t, entries) + cred_batch.count * sizeof(cred_entry_t) ||
+        cred_batch.crc != esp_rom_crc32_le(0, (const uint8_t *)cred_batch.entries, cred_batch.count * sizeof(cred_entry_t))) {
+        ESP_LOGE("CRED", "Courier batch corrupt, discarded");
+        cred_batch.count = 0;
+        cred_batch.id = 0;
+    }
+}
+
+// Runs on app_task. Codes already used by the table are skipped; returns
+// how many were stored.
+static int cred_batch_apply(const cred_entry_t *entries, int n) {
+    for (int i = 0; i < cred_batch.count; i++) {
+        cred_remove(CRED_TABLE_MAX + i);
+    }
+    cred_batch.count = 0;
+    do {
+        cred_batch.id = esp_random();  // Not a counter: NVS can be erased while the partition keeps its records
+    } while (cred_batch.id == 0);
+
+    for (int i = 0; i < n && cred_batch.count < CRED_BATCH_MAX; i++) {
+        if (cred_find(entries[i].digest) >= 0) {
+            ESP_LOGW("CRED", "Courier code %d duplicates a stored PIN, skipped", i);
+            continue;
+        }
+        cred_batch.entries[cred_batch.count] = entries[i];
+        cred_index_add(CRED_TABLE_MAX + cred_batch.count++);
+    }
+    cred_batch_save();
+    consumed_open(cred_batch.id);
+    return cred_batch.count;
+}
+
+// Consumed Code Bitmap
+// Flash bits only go from 1 to 0 without an erase, so an unused slot is a set
+// bit and marking a code used rewrites the one byte holding its bit. Each new
+// batch starts a fresh record after the last one; only when the sector is
+// full is it erased, once every CONSUMED_RECORDS batches. Without the
+// partition the bitmap falls back to an NVS blob rewritten on every mark.
+// Batch id 0 means there is no batch, and nothing to mark.
+static void consumed_open(uint32_t batch_id) {
+    consumed_header_t hdr;
+    int next = 0;
+
+    memset(consumed_bits, 0xFF, sizeof(consumed_bits));
+    if (batch_id == 0) {
+        return;
+    }
+    if (consumed_part == NULL) {
+        consumed_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, CONSUMED_SUBTYPE, CONSUMED_PARTITION);
+    }
+    if (consumed_part == NULL) {
+        size_t size = sizeof(consumed_bits);
+        uint32_t stored_id;
+        if (nvs_get_u32(nvs_handler, "consumed_id", &stored_id) != ESP_OK || stored_id != batch_id ||
+            nvs_get_blob(nvs_handler, "consumed", consumed_bits, &size) != ESP_OK) {
+            memset(consumed_bits, 0xFF, sizeof(consumed_bits));
+            nvs_set_u32(nvs_handler, "consumed_id", batch_id);
+            nvs_cache_mark(NVS_FIELD_CONSUMED);
+            nvs_cache_commit(true);
+        } else {
+            nvs_cache_seed(NVS_FIELD_CONSUMED);
+        }
+        return;
+    }
+
+    // Records are written in order, so the first blank one ends the scan
+    for (; next < CONSUMED_RECORDS; next++) {
+        esp_partition_read(consumed_part, next * CONSUMED_RECORD_SIZE, &hdr, sizeof(hdr));
+        if (hdr.magic != CONSUMED_MAGIC) {
+            break;
+        }
+    }
+    if (next > 0) {
+        esp_partition_read(consumed_part, (next - 1) * CONSUMED_RECORD_SIZE, &hdr, sizeof(hdr));
+        if (hdr.batch_id == batch_id) {
+            consumed_record = next - 1;
+            esp_partition_read(consumed_part, consumed_record * CONSUMED_RECORD_SIZE + sizeof(hdr),
+                               consumed_bits, sizeof(consumed_bits));
+            return;
+        }
+    }
+
+    if (next == CONSUMED_RECORDS) {
+        esp_partition_erase_range(consumed_part, 0, CONSUMED_SECTOR_SIZE);
+        consumed_erases++;
+        ESP_LOGI("CRED", "Consumed bitmap sector erased (%u since boot)", (unsigned)consumed_erases);
+        next = 0;
+    }
+    hdr.magic = CONSUMED_MAGIC;
+    hdr.batch_id = batch_id;
+    esp_partition_write(consumed_part, next * CONSUMED_RECORD_SIZE, &hdr, sizeof(hdr));
+    consumed_record = next;
+}
+
+static bool consumed_test(int slot) {
+    return !(consumed_bits[slot / 8] & (1 << (slot % 8)));
+}
+
+static void consumed_mark(int slot) {
+    uint8_t *byte = &consumed_bits[slot / 8];
+
+    *byte &= ~(1 << (slot % 8));
+    if (consumed_part == NULL) {
+        nvs_cache_mark(NVS_FIELD_CONSUMED);
+        nvs_cache_commit(true);
+        return;
+    }
+    esp_partition_write(consumed_part, consumed_record * CONSUMED_RECORD_SIZE + sizeof(consumed_header_t) + slot / 8,
+                        byte, 1);
+}
+
+// Appends one code to a staged batch; returns the new count
+static int cred_batch_add(cred_entry_t *entries, int n, const char *code, uint32_t valid_from, uint32_t expires) {
+    size_t len = strlen(code);
+
+    if (n >= CRED_BATCH_MAX || len != CRED_CODE_DIGITS || strspn(code, "0123456789") != len) {
+        ESP_LOGW("CRED", "Rejected courier code '%s'", code);
+        return n;
+    }
+    memset(&entries[n], 0, sizeof(entries[n]));
+    cred_derive(code, entries[n].digest);
+    entries[n].valid_from = valid_from;
+    entries[n].expires = expires;
+    entries[n].uses_left = 1;
+    entries[n].role = CRED_ROLE_COURIER;
+    return n + 1;
+}
+
+// Appends count distinct random CRED_CODE_DIGITS-digit codes from the
+// hardware RNG, echoing each once since only digests are kept
+static int cred_batch_generate(cred_entry_t *entries, int n, int count, uint32_t valid_from, uint32_t expires) {
+    const uint32_t limit = UINT32_MAX - UINT32_MAX % CRED_CODE_SPACE;  // Rejection keeps the digits uniform
+    uint32_t *taken = calloc(CRED_BATCH_MAX, sizeof(uint32_t));
+    int generated = 0;
+    char code[CRED_CODE_DIGITS + 1];
+
+    if (taken == NULL) {
+        return n;
+    }
+    while (count-- > 0 && n < CRED_BATCH_MAX) {
+        uint32_t r, v;
+        bool clash;
+        do {
+            r = esp_random();
+            v = r % CRED_CODE_SPACE;
+            clash = false;
+            for (int i = 0; i < generated && !clash; i++) {
+                clash = taken[i] == v;
+            }
+        } while (r >= limit || clash);
+        taken[generated++] = v;
+
+        snprintf(code, sizeof(code), "%0*u", CRED_CODE_DIGITS, (unsigned)v);
+        n = cred_batch_add(entries, n, code, valid_from, expires);
+        // Straight to the provisioning console, never through the log
+        uart_write_bytes(LAT_CONSOLE_UART, code, strlen(code));
+        uart_write_bytes(LAT_CONSOLE_UART, "\r\n", 2);
+    }
+    memset(code, 0, sizeof(code));
+    memset(taken, 0, CRED_BATCH_MAX * sizeof(uint32_t));
+    free(taken);
+    return n;
+}
+
+// Plaintext PIN left by older firmware (then erased), else the default
+static void cred_legacy_pin(const char *key, const char *fallback, char *pin) {
+    size_t size = 6;
+
+    if (nvs_get_blob(nvs_handler, key, pin, &size) == ESP_OK && size > 0) {
+        pin[5] = '\0';
+        nvs_erase_key(nvs_handler, key);
+        ESP_LOGI("CRED", "Migrated %s", key);
+    } else {
+        strcpy(pin, fallback);
+    }
+}
+
+// Times the KDF and logs the iteration count that fits CRED_VERIFY_BUDGET_MS.
+// The SHA backend is fixed at build time: compare by rebuilding with
+// CONFIG_MBEDTLS_HARDWARE_SHA toggled.
+static void cred_calibrate(void) {
+    const int otp_window = OTP_HOTP_LOOKAHEAD + 2 * OTP_TOTP_SKEW + 1;
+    uint8_t digest[CRED_DIGEST_LEN];
+    mbedtls_md_context_t ctx;
+
+    int64_t start = esp_timer_get_time();
+    mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA256, (const unsigned char *)"00000", 5, cred_hdr.salt,
+                                  CRED_SALT_LEN, CRED_CALIBRATE_ITERATIONS, CRED_DIGEST_LEN, digest);
+    int64_t us = esp_timer_get_time() - start;
+    if (us <= 0) {
+        us = 1;
+    }
+
+#ifdef CONFIG_MBEDTLS_HARDWARE_SHA
+    const char *backend = "hardware";
+#else
+    const char *backend = "software";
+#endif
+    uint32_t per_second = (uint64_t)CRED_CALIBRATE_ITERATIONS * 1000000 / us;
+    uint32_t fit = (uint64_t)CRED_CALIBRATE_ITERATIONS * CRED_VERIFY_BUDGET_MS * 1000 / us;
+    ESP_LOGI("CRED", "PBKDF2-SHA256, %s SHA: %u iterations/s, %u fit in %d ms (table uses %u = %u ms)",
+             backend, (unsigned)per_second, (unsigned)fit, CRED_VERIFY_BUDGET_MS, (unsigned)cred_hdr.iterations,
+             (unsigned)((uint64_t)us * cred_hdr.iterations / CRED_CALIBRATE_ITERATIONS / 1000));
+
+    // A missed OTP costs the whole window, after the KDF of the table lookup
+    mbedtls_md_init(&ctx);
+    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA1), 1);
+    mbedtls_md_hmac_starts(&ctx, digest, sizeof(digest));
+    start = esp_timer_get_time();
+    for (int i = 0; i < otp_window; i++) {
+        otp_code(&ctx, i);
+    }
+    us = esp_timer_get_time() - start;
+    mbedtls_md_free(&ctx);
+    ESP_LOGI("OTP", "HMAC-SHA1, %s SHA: %d-code window in %u us", backend, otp_window, (unsigned)us);
+}
+
+// One-Time Courier Codes
+// The carrier backend holds the box secret and mints codes offline: HOTP from
+// its own counter, or TOTP from the time. A code is accepted once, anywhere
+// in the look-ahead window, so codes handed to several couriers may be used
+// out of order. Every counter in the window is tried, hit or miss, so a
+// miss costs OTP_HOTP_LOOKAHEAD + 2 * OTP_TOTP_SKEW + 1 HMACs.
+static void otp_load(void) {
+    size_t size = sizeof(otp_secret);
+
+    if (nvs_get_blob(nvs_handler, "otp_secret", otp_secret, &size) != ESP_OK || size != sizeof(otp_secret)) {
+        esp_fill_random(otp_secret, sizeof(otp_secret));
+        memset(&otp_state, 0, sizeof(otp_state));
+        nvs_cache_mark(NVS_FIELD_OTP_SECRET);
+        nvs_cache_mark(NVS_FIELD_OTP_STATE);
+        nvs_cache_commit(false);  // With the rest of first boot
+        return;
+    }
+    nvs_cache_seed(NVS_FIELD_OTP_SECRET);
+    size = sizeof(otp_state);
+    if (nvs_get_blob(nvs_handler, "otp_state", &otp_state, &size) != ESP_OK || size != sizeof(otp_state)) {
+        memset(&otp_state, 0, sizeof(otp_state));
+    } else {
+        nvs_cache_seed(NVS_FIELD_OTP_STATE);
+    }
+}
+
+// Committed at once so a redeemed code stays redeemed across a power cut
+static void otp_save(void) {
+    nvs_cache_mark(NVS_FIELD_OTP_STATE);
+    nvs_cache_commit(true);
+}
+
+// ctx holds the keyed HMAC; reset reuses it for each counter
+static uint32_t otp_code(mbedtls_md_context_t *ctx, uint64_t counter) {
+    uint8_t msg[8], mac[20];
+
+    for (int i = 7; i >= 0; i--) {
+        msg[i] = counter;
+        counter >>= 8;
+    }
+    mbedtls_md_hmac_reset(ctx);
+    mbedtls_md_hmac_update(ctx, msg, sizeof(msg));
+    mbedtls_md_hmac_finish(ctx, mac);
+
+    int off = mac[19] & 0x0F;
+    uint32_t bin = (uint32_t)(mac[off] & 0x7F) << 24 | (uint32_t)mac[off + 1] << 16 |
+                   (uint32_t)mac[off + 2] << 8 | mac[off + 3];
+    return bin % OTP_MODULUS;
+}
+
+static bool otp_totp_redeemed(uint32_t step) {
+    for (int i = 0; i < OTP_TOTP_REDEEMED; i++) {
+        if (otp_state.totp_redeemed[i] == step) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Redeems input if it is an unused HOTP or TOTP code
+static bool otp_verify(const char *input) {
+    mbedtls_md_context_t ctx;
+    uint32_t now = time(NULL);
+    int hotp = -1;
+    uint32_t totp = 0;
+
+    if (strlen(input) != OTP_DIGITS) {
+        return false;
+    }
+    uint32_t code = strtoul(input, NULL, 10);
+
+    mbedtls_md_init(&ctx);
+    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA1), 1);
+    mbedtls_md_hmac_starts(&ctx, otp_secret, sizeof(otp_secret));
+    for (int i = 0; i < OTP_HOTP_LOOKAHEAD; i++) {
+        if (otp_code(&ctx, otp_state.hotp_base + i) == code && hotp < 0 && !((otp_state.hotp_redeemed >> i) & 1)) {
+            hotp = i;
+        }
+    }
+    if (now >= OTP_CLOCK_VALID) {
+        uint32_t step = now / OTP_TOTP_STEP_S;
+        for (uint32_t t = step - OTP_TOTP_SKEW; t <= step + OTP_TOTP_SKEW; t++) {
+            if (otp_code(&ctx, t) == code && totp == 0 && !otp_totp_redeemed(t)) {
+                totp = t;
+            }
+        }
+    }
+    mbedtls_md_free(&ctx);
+
+    if (hotp >= 0) {
+        ESP_LOGI("OTP", "HOTP counter %u redeemed", (unsigned)(otp_state.hotp_base + hotp));
+        otp_state.hotp_redeemed |= 1ULL << hotp;
+        while (otp_state.hotp_redeemed & 1) {
+            otp_state.hotp_redeemed >>= 1;
+            otp_state.hotp_base++;
+        }
+    } else if (totp) {
+        otp_state.totp_redeemed[otp_state.totp_next] = totp;
+        otp_state.totp_next = (otp_state.totp_next + 1) % OTP_TOTP_REDEEMED;
+        ESP_LOGI("OTP", "TOTP step %u redeemed", (unsigned)totp);
+    } else {
+        return false;
+    }
+    otp_save();
+    return true;
+}
+
+// Runs on app_task
+static void otp_set_secret(const uint8_t *secret) {
+    memcpy(otp_secret, secret, sizeof(otp_secret));
+    memset(&otp_state, 0, sizeof(otp_state));
+    nvs_cache_mark(NVS_FIELD_OTP_SECRET);
+    otp_save();
+}
+
+// Console 'o': shows the counters, then reads a line: 'show' prints the
+// secret for enrolling the box with the carrier backend, 40 hex digits
+// replace it and reset the counters, an empty line keeps it
+static void otp_console(void) {
+    char line[2 * OTP_SECRET_LEN + 2], hex[2 * OTP_SECRET_LEN + 1];
+
+    ESP_LOGI("OTP", "HOTP base %u, TOTP step %d s; 'show', a new secret or an empty line",
+             (unsigned)otp_state.hotp_base, OTP_TOTP_STEP_S);
+    console_read_line(line, sizeof(line));
+    if (line[0] == '\0') {
+        return;
+    }
+    if (strcmp(line, "show") == 0) {
+        // Straight to the console, never through the log
+        for (int i = 0; i < OTP_SECRET_LEN; i++) {
+            snprintf(&hex[2 * i], 3, "%02x", otp_secret[i]);
+        }
+        uart_write_bytes(LAT_CONSOLE_UART, hex, 2 * OTP_SECRET_LEN);
+        uart_write_bytes(LAT_CONSOLE_UART, "\r\n", 2);
+        memset(hex, 0, sizeof(hex));
+        return;
+    }
+    if (strlen(line) != 2 * OTP_SECRET_LEN || strspn(line, "0123456789abcdefABCDEF") != 2 * OTP_SECRET_LEN) {
+        ESP_LOGW("OTP", "Secret must be %d hex digits", 2 * OTP_SECRET_LEN);
+        return;
+    }
+    for (int i = 0; i < OTP_SECRET_LEN; i++) {
+        char byte[3] = { line[2 * i], line[2 * i + 1], '\0' };
+        otp_secret_staged[i] = strtoul(byte, NULL, 16);
+    }
+    xTaskNotify(app_task_handle, APP_NOTIFY_OTP_SECRET, eSetBits);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ESP_LOGI("OTP", "Secret replaced, counters reset");
+}
+
+// Attempt Rate Limiting
+// Each channel's bucket holds RATE_BURST attempts. A wrong PIN takes one; the
+// one that empties the bucket adds a strike and locks the channel for
+// RATE_BACKOFF_BASE_MS << (strikes - 1), after which one attempt is allowed,
+// and refill only resumes from the end of the lockout. A correct PIN clears
+// the channel. The buckets live in RTC memory, so attempts cost no flash
+// writes; NVS only records strike changes and the first wrong PIN after a
+// correct one. After power loss a channel with wrong PINs on record starts
+// with an empty bucket and a full lockout, so power cycling buys nothing.
+static uint32_t rate_backoff_ms(uint8_t strikes) {
+    if (strikes == 0) {
+        return 0;
+    }
+    if (strikes > 14 || (RATE_BACKOFF_BASE_MS << (strikes - 1)) > RATE_BACKOFF_MAX_MS) {
+        return RATE_BACKOFF_MAX_MS;
+    }
+    return RATE_BACKOFF_BASE_MS << (strikes - 1);
+}
+
+static void rate_refill(rate_bucket_t *bucket, int64_t now_ms) {
+    if (now_ms < bucket->locked_until_ms) {
+        return;
+    }
+    if (bucket->tokens == 0) {
+        bucket->tokens = 1;  // The lockout has been served
+        bucket->refilled_ms = bucket->locked_until_ms;
+    }
+    int64_t gained = (now_ms - bucket->refilled_ms) / RATE_REFILL_MS;
+    if (bucket->tokens + gained >= RATE_BURST) {
+        bucket->tokens = RATE_BURST;
+        bucket->refilled_ms = now_ms;
+    } else {
+        bucket->tokens += gained;
+        bucket->refilled_ms += gained * RATE_REFILL_MS;
+    }
+}
+
+static void rate_seal(void) {
+    rate_rtc.magic = RATE_RTC_MAGIC;
+    rate_rtc.crc = esp_rom_crc32_le(0, (const uint8_t *)rate_rtc.buckets, sizeof(rate_rtc.buckets));
+}
+
+// Committed at once, or cutting power before the deferral ran out would
+// erase the strike
+static void rate_save(void) {
+    for (int i = 0; i < RATE_CH_COUNT; i++) {
+        rate_saved[i].strikes = rate_rtc.buckets[i].strikes;
+        rate_saved[i].dirty = rate_rtc.buckets[i].dirty;
+    }
+    nvs_cache_mark(NVS_FIELD_RATE_STATE);
+    nvs_cache_commit(true);
+    rate_nvs_writes++;
+}
+
+// The clock restarted with the reset, so the time left on a lockout is
+// unknown: a channel with a pending lockout serves it again in full
+static void rate_load(int64_t now_ms) {
+    size_t size = sizeof(rate_saved);
+
+    if (rate_rtc.magic != RATE_RTC_MAGIC ||
+        rate_rtc.crc != esp_rom_crc32_le(0, (const uint8_t *)rate_rtc.buckets, sizeof(rate_rtc.buckets))) {
+        if (nvs_get_blob(nvs_handler, "rate_state", rate_saved, &size) != ESP_OK || size != sizeof(rate_saved)) {
+            memset(rate_saved, 0, sizeof(rate_saved));
+        } else {
+            nvs_cache_seed(NVS_FIELD_RATE_STATE);
+        }
+        for (int i = 0; i < RATE_CH_COUNT; i++) {
+            rate_bucket_t *bucket = &rate_rtc.buckets[i];
+            bucket->strikes = rate_saved[i].strikes;
+            bucket->dirty = rate_saved[i].dirty;
+            bucket->tokens = bucket->dirty ? 0 : RATE_BURST;
+        }
+        ESP_LOGI("RATE", "Attempt buckets restored from NVS");
+    }
+
+    for (int i = 0; i < RATE_CH_COUNT; i++) {
+        rate_bucket_t *bucket = &rate_rtc.buckets[i];
+        bucket->refilled_ms = now_ms;
+        bucket->locked_until_ms = 0;
+        if (bucket->tokens == 0) {
+            bucket->locked_until_ms = now_ms + rate_backoff_ms(bucket->strikes ? bucket->strikes : 1);
+            ESP_LOGW("RATE", "Channel %d locked out for %u s after reset", i,
+                     (unsigned)((bucket->locked_until_ms - now_ms) / 1000));
+        }
+    }
+    rate_seal();
+}
+
+// Milliseconds until channel may try a PIN, 0 if it may now
+static uint32_t rate_wait_ms(rate_channel_t channel, int64_t now_ms) {
+    rate_bucket_t *bucket = &rate_rtc.buckets[channel];
+
+    rate_refill(bucket, now_ms);
+    rate_seal();
+    return bucket->tokens ? 0 : bucket->locked_until_ms - now_ms;
+}
+
+// Accounts for an attempt rate_wait_ms allowed
+static void rate_record(rate_channel_t channel, bool ok, int64_t now_ms) {
+    rate_bucket_t *bucket = &rate_rtc.buckets[channel];
+    bool changed;
+
+    if (ok) {
+        changed = bucket->dirty || bucket->strikes;
+        bucket->tokens = RATE_BURST;
+        bucket->strikes = 0;
+        bucket->dirty = false;
+        bucket->locked_until_ms = 0;
+        bucket->refilled_ms = now_ms;
+    } else {
+        rate_refill(bucket, now_ms);
+        changed = !bucket->dirty;
+        bucket->dirty = true;
+        if (bucket->tokens > 0 && --bucket->tokens == 0) {
+            if (bucket->strikes < RATE_STRIKES_MAX) {
+                bucket->strikes++;
+            }
+            bucket->locked_until_ms = now_ms + rate_backoff_ms(bucket->strikes);
+            changed = true;
+            ESP_LOGW("RATE", "Channel %d locked out for %u s (strike %u)", channel,
+                     (unsigned)(rate_backoff_ms(bucket->strikes) / 1000), bucket->strikes);
+        }
+    }
+    rate_seal();
+    if (changed) {
+        rate_save();
+    }
+}
+
+// Shows the lockout screen and returns true while channel is locked out
+static bool rate_refuse(rate_channel_t channel) {
+    uint32_t wait_ms = rate_wait_ms(channel, esp_timer_get_time() / 1000);
+
+    if (wait_ms == 0) {
+        return false;
+    }
+    ESP_LOGW("RATE", "PIN refused, %u s of lockout left", (unsigned)((wait_ms + 999) / 1000));
+    lcd_show_message_icon(&tmpl_try_later, GLYPH_LOCK, 2000);
+    return true;
+}
+
+// Password Management
+// Defaults are only used when there is no table at all. A table that exists
+// but cannot be read fails closed: every PIN is refused until it is reset
+// from the console ('R'), never silently back to the public default PINs.
+static void load_passwords(void) {
+    otp_load();
+    rate_load(esp_timer_get_time() / 1000);
+
+    esp_err_t err = cred_table_load();
+    if (err == ESP_OK) {
+        ESP_LOGI("CRED", "Loaded %u credentials", (unsigned)cred_hdr.count);
+        return;
+    }
+    if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE("CRED", "Credential table unreadable (%d); PINs refused until reset with 'R'", err);
+        memset(cred_entries, 0, sizeof(cred_entries));
+        memset(cred_index, 0, sizeof(cred_index));
+        cred_batch.count = 0;
+        cred_table_failed = true;
+        return;
+    }
+    cred_table_reset();
+}
+
+// Console 'R': asks for confirmation, then has app_task replace the table
+// with a new one (default PINs, or pending earlier-format records)
+static void console_cred_reset(void) {
+    char line[8];
+
+    ESP_LOGW("CRED", "Type RESET to replace the credential table; courier codes are kept");
+    console_read_line(line, sizeof(line));
+    if (strcmp(line, "RESET") != 0) {
+        ESP_LOGI("CRED", "Reset cancelled");
+        return;
+    }
+    xTaskNotify(app_task_handle, APP_NOTIFY_CRED_RESET, eSetBits);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ESP_LOGI("CRED", "Credential table reset");
+}
+
+// Initialize I2C
+static esp_err_t i2c_master_init(void) {
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = I2C_MASTER_SDA_IO,
+        .scl_io_num = I2C_MASTER_SCL_IO,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = I2C_MASTER_FREQ_HZ,
+    };
+    
+    esp_err_t err = i2c_param_config(I2C_MASTER_NUM, &conf);
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    return i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0);
+}
+
+// Hardware Initialization
+static void hardware_init(void) {
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &nvs_handler));
+    esp_register_shutdown_handler(nvs_cache_flush);  // Deferred saves go out before esp_restart()
+
+    // Initialize lock pin
+    lock_actuator_init();
+
+    // Initialize master and guest LED pins
+    led_init();
+
+    // Door sensor; both edges restart the debounce timer. Armed by
+    // door_sensor_arm() once app_task exists to take its notifications.
+    gpio_install_isr_service(0);
+    gpio_reset_pin(DOOR_SENSOR_PIN);
+    gpio_set_direction(DOOR_SENSOR_PIN, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(DOOR_SENSOR_PIN, GPIO_PULLUP_ONLY);
+    gpio_set_intr_type(DOOR_SENSOR_PIN, GPIO_INTR_ANYEDGE);
+    gpio_intr_disable(DOOR_SENSOR_PIN);
+    gpio_isr_handler_add(DOOR_SENSOR_PIN, door_isr_handler, NULL);
+
+    // Rows wake the keypad task on a falling edge; armed only while idle
+    for (int i = 0; i < ROWS; i++) {
+        gpio_reset_pin(row_pins[i]);
+        gpio_set_direction(row_pins[i], GPIO_MODE_INPUT);
+        gpio_set_pull_mode(row_pins[i], GPIO_PULLUP_ONLY);
+        gpio_set_intr_type(row_pins[i], GPIO_INTR_NEGEDGE);
+        gpio_intr_disable(row_pins[i]);
+        gpio_isr_handler_add(row_pins[i], keypad_isr_handler, NULL);
+    }
+
+    for (int i = 0; i < COLS; i++) {
+        gpio_reset_pin(col_pins[i]);
+        gpio_set_direction(col_pins[i], GPIO_MODE_OUTPUT);
+        gpio_set_level(col_pins[i], 1);
+    }
+
+    ESP_ERROR_CHECK(i2c_master_init());
+    
+    lcd_init();
+}
+
+// Lock Actuator
+// The solenoid on LOCK_PIN gets full power for LOCK_PULL_IN_MS, then a
+// LOCK_HOLD_DUTY_PCT PWM hold until released, which cuts the holding current
+// for the rest of the unlock window. LOCK_DRIVE_PULSE stops after the pull-in
+// for latching locks, which stay open until a LOCK_PULL_IN_MS reverse pulse on
+// LOCK_RELEASE_PIN. Energy is estimated from the coil power and duty.
+static void lock_actuator_init(void) {
+    ledc_timer_config_t timer = {
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .duty_resolution = LEDC_TIMER_10_BIT,
+        .timer_num = LEDC_TIMER_1,
+        .freq_hz = LOCK_PWM_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    ESP_ERROR_CHECK(ledc_timer_config(&timer));
+
+    ledc_channel_config_t channel = {
+        .gpio_num = LOCK_PIN,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .channel = LEDC_CHANNEL_2,
+        .timer_sel = LEDC_TIMER_1,
+        .duty = 0,
+        .hpoint = 0,
+    };
+    ESP_ERROR_CHECK(ledc_channel_config(&channel));
+
+    if (LOCK_DRIVE_MODE == LOCK_DRIVE_PULSE) {
+        gpio_reset_pin(LOCK_RELEASE_PIN);
+        gpio_set_direction(LOCK_RELEASE_PIN, GPIO_MODE_OUTPUT);
+        gpio_set_level(LOCK_RELEASE_PIN, 0);
+    }
+
+    esp_timer_create_args_t args = {
+        .callback = lock_actuator_pull_in_done,
+        .name = "lock_pull_in",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &lock_actuator.pull_in_timer));
+    lock_actuator.mutex = xSemaphoreCreateMutex();
+}
+
+static void lock_actuator_duty(uint32_t pct) {
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2, pct * LOCK_DUTY_MAX / 100);
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2);
+}
+
+// Called with the mutex held when an actuation ends
+static void lock_actuator_account(int64_t now) {
+    int64_t pull_in_end = lock_actuator.hold_us ? lock_actuator.hold_us : now;
+    uint32_t pull_in_ms = (pull_in_end - lock_actuator.pull_in_us) / 1000;
+    uint32_t hold_ms = lock_actuator.hold_us ? (now - lock_actuator.hold_us) / 1000 : 0;
+
+    // mW * ms = uJ
+    uint64_t uj = (uint64_t)LOCK_COIL_MW * pull_in_ms + (uint64_t)LOCK_COIL_MW * hold_ms * LOCK_HOLD_DUTY_PCT / 100;
+    lock_actuator.last_mj = uj / 1000;
+    lock_actuator.total_mj += lock_actuator.last_mj;
+    lock_actuator.actuations++;
+    ESP_LOGI("LOCK", "Actuation %u: %u ms pull-in, %u ms hold at %d%%, %u mJ (total %u mJ)",
+             (unsigned)lock_actuator.actuations, (unsigned)pull_in_ms, (unsigned)hold_ms,
+             LOCK_HOLD_DUTY_PCT, (unsigned)lock_actuator.last_mj, (unsigned)lock_actuator.total_mj);
+}
+
+// Ends the pull-in, or the release pulse
+static void lock_actuator_pull_in_done(void *arg) {
+    xSemaphoreTake(lock_actuator.mutex, portMAX_DELAY);
+    if (lock_actuator.state == LOCK_ACT_RELEASE) {
+        gpio_set_level(LOCK_RELEASE_PIN, 0);
+        lock_actuator_account(esp_timer_get_time());
+        lock_actuator.state = LOCK_ACT_OFF;
+    } else if (lock_actuator.state == LOCK_ACT_PULL_IN) {
+        if (LOCK_DRIVE_MODE == LOCK_DRIVE_PULSE) {
+            lock_actuator_duty(0);
+            lock_actuator_account(esp_timer_get_time());
+            lock_actuator.state = LOCK_ACT_LATCHED;
+        } else {
+            lock_actuator_duty(LOCK_HOLD_DUTY_PCT);
+            lock_actuator.hold_us = esp_timer_get_time();
+            lock_actuator.state = LOCK_ACT_HOLD;
+        }
+    }
+    xSemaphoreGive(lock_actuator.mutex);
+}
+
+// Pull in, unless already energised or latched open
+static void lock_actuator_engage(void) {
+    xSemaphoreTake(lock_actuator.mutex, portMAX_DELAY);
+    if (lock_actuator.state == LOCK_ACT_RELEASE) {
+        // Unlocked again mid-release: never drive both directions at once
+        esp_timer_stop(lock_actuator.pull_in_timer);
+        gpio_set_level(LOCK_RELEASE_PIN, 0);
+        lock_actuator_account(esp_timer_get_time());
+        lock_actuator.state = LOCK_ACT_OFF;
+    }
+    if (lock_actuator.state == LOCK_ACT_OFF) {
+        lock_actuator_duty(100);
+        lock_actuator.pull_in_us = esp_timer_get_time();
+        lock_actuator.hold_us = 0;
+        lock_actuator.state = LOCK_ACT_PULL_IN;
+        esp_timer_start_once(lock_actuator.pull_in_timer, LOCK_PULL_IN_MS * 1000ULL);
+    }
+    xSemaphoreGive(lock_actuator.mutex);
+}
+
+// A latching lock gets its reverse pulse, even when cut short during pull-in
+static void lock_actuator_release(void) {
+    xSemaphoreTake(lock_actuator.mutex, portMAX_DELAY);
+    if (lock_actuator.state == LOCK_ACT_PULL_IN || lock_actuator.state == LOCK_ACT_HOLD) {
+        esp_timer_stop(lock_actuator.pull_in_timer);
+        lock_actuator_duty(0);
+        lock_actuator_account(esp_timer_get_time());
+        lock_actuator.state = (LOCK_DRIVE_MODE == LOCK_DRIVE_PULSE) ? LOCK_ACT_LATCHED : LOCK_ACT_OFF;
+    }
+    if (lock_actuator.state == LOCK_ACT_LATCHED) {
+        gpio_set_level(LOCK_RELEASE_PIN, 1);
+        lock_actuator.pull_in_us = esp_timer_get_time();
+        lock_actuator.hold_us = 0;
+        lock_actuator.state = LOCK_ACT_RELEASE;
+        esp_timer_start_once(lock_actuator.pull_in_timer, LOCK_PULL_IN_MS * 1000ULL);
+    }
+    xSemaphoreGive(lock_actuator.mutex);
+}
+
+// Lock Control
+// Unlocking drives LOCK_PIN and (re)starts the one-shot relock timer, then
+// returns; unlocking again while open restarts the full window, and the master
+// PIN entered while open extends it up to UNLOCK_MAX_MS in total. The timer
+// callback only notifies app_task, which releases the actuator (its mutex
+// must not block the timer service task) and leaves DOOR_UNLOCKED.
+// If the door sensor sees the door open and close again, the window is cut
+// to DOOR_RELOCK_GRACE_MS; a door that is never opened relocks at the timeout.
+static void relock_timer_callback(TimerHandle_t timer) {
+    xTaskNotify(app_task_handle, APP_NOTIFY_RELOCK, eSetBits);
+}
+
+static uint32_t lock_remaining_ms(void) {
+    if (!xTimerIsTimerActive(relock_timer)) {
+        return 0;
+    }
+    TickType_t left = xTimerGetExpiryTime(relock_timer) - xTaskGetTickCount();
+    return ((int32_t)left > 0) ? left * portTICK_PERIOD_MS : 0;
+}
+
+// Door Sensor
+// Edges only restart door_timer; its callback reads the settled level in the
+// timer service task, the same task that expires relock_timer, so the two cannot race.
+static void IRAM_ATTR door_isr_handler(void *arg) {
+    BaseType_t woken = pdFALSE;
+
+    xTimerResetFromISR(door_timer, &woken);
+    portYIELD_FROM_ISR(woken);
+}
 
-    // Initialize guest LED pin
-    gpio_reset_pin(GUEST_LED_PIN);
-    gpio_set_direction(GUEST_LED_PIN, GPIO_MODE_OUTPUT);
-    gpio_set_level(GUEST_LED_PIN, 0);
+static bool door_sensor_open(void) {
+    return gpio_get_level(DOOR_SENSOR_PIN) != DOOR_CLOSED_LEVEL;
+}
 
-    // Initialize master LED pin
-    gpio_reset_pin(MASTER_LED_PIN);
-    gpio_set_direction(MASTER_LED_PIN, GPIO_MODE_OUTPUT);
-    gpio_set_level(MASTER_LED_PIN, 0);
+// Called from app_main after app_task is created. The level is sampled
+// before the edges are enabled, so a door moving in between is still seen.
+static void door_sensor_arm(void) {
+    door_open = door_sensor_open();
+    gpio_intr_enable(DOOR_SENSOR_PIN);
+}
 
-    for (int i = 0; i < ROWS; i++) {
-        gpio_reset_pin(row_pins[i]);
-        gpio_set_direction(row_pins[i], GPIO_MODE_INPUT);
-        gpio_set_pull_mode(row_pins[i], GPIO_PULLUP_ONLY);
+static void door_timer_callback(TimerHandle_t timer) {
+    bool open = door_sensor_open();
+    if (open == door_open) {
+        return;  // Bounced back
     }
+    door_open = open;
 
-    for (int i = 0; i < COLS; i++) {
-        gpio_reset_pin(col_pins[i]);
-        gpio_set_direction(col_pins[i], GPIO_MODE_OUTPUT);
-        gpio_set_level(col_pins[i], 1);
+    bool unlocked = xTimerIsTimerActive(relock_timer);
+    if (open && !unlocked) {
+        door_forced_count++;
+        ESP_LOGW("DOOR", "Door forced open while locked (%u)", (unsigned)door_forced_count);
+        xTaskNotify(app_task_handle, APP_NOTIFY_FORCED, eSetBits);
+    } else if (open) {
+        atomic_store(&door_opened, true);
+        ESP_LOGI("DOOR", "Door opened");
+    } else if (unlocked && atomic_load(&door_opened)) {
+        xTimerChangePeriod(relock_timer, pdMS_TO_TICKS(DOOR_RELOCK_GRACE_MS), 0);
+        ESP_LOGI("DOOR", "Door closed, relocking in %d ms", DOOR_RELOCK_GRACE_MS);
+    } else {
+        ESP_LOGI("DOOR", "Door closed");
     }
+}
 
-    i2c_config_t conf = {
-        .mode = I2C_MODE_MASTER,
-        .sda_io_num = I2C_MASTER_SDA_IO,
-        .scl_io_num = I2C_MASTER_SCL_IO,
-        .sda_pullup_en = GPIO_PULLUP_ENABLE,
-        .scl_pullup_en = GPIO_PULLUP_ENABLE,
-        .master.clk_speed = 100000,
-    };
-    
-    ESP_ERROR_CHECK(i2c_param_config(I2C_MASTER_NUM, &conf));
-    ESP_ERROR_CHECK(i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0));
-    
-    lcd_init();
+// Another UNLOCK_DURATION_MS from now, within UNLOCK_MAX_MS of the unlock.
+// door_opened is kept, so closing the door still cuts the window short.
+// False if that would not add time, or the window has already run out.
+static bool lock_extend(void) {
+    uint32_t elapsed_ms = (xTaskGetTickCount() - unlock_started) * portTICK_PERIOD_MS;
+    uint32_t window_ms = UNLOCK_DURATION_MS;
+
+    if (elapsed_ms >= UNLOCK_MAX_MS) {
+        return false;
+    }
+    if (window_ms > UNLOCK_MAX_MS - elapsed_ms) {
+        window_ms = UNLOCK_MAX_MS - elapsed_ms;
+    }
+    if (window_ms <= lock_remaining_ms()) {
+        return false;
+    }
+    // Checked last: once expired the relock is already on its way to app_task
+    if (!xTimerIsTimerActive(relock_timer)) {
+        return false;
+    }
+    xTimerChangePeriod(relock_timer, pdMS_TO_TICKS(window_ms), 0);  // Also restarts it
+    ESP_LOGI("LOCK", "Unlock extended to %u ms from now", (unsigned)window_ms);
+    return true;
 }
 
-// Lock Control
 static void control_lock(bool unlock) {
     if (unlock) {
-        // Unlock - set pin HIGH (1) for 1 minute (60000ms)
-        gpio_set_level(LOCK_PIN, 1);
-        ESP_LOGI("LOCK", "Door unlocked (PIN4 HIGH)");
-        
-        // Keep unlocked for 1 minute (60000ms)
-        vTaskDelay(pdMS_TO_TICKS(60000));
-        
-        // Relock - set pin LOW (0)
-        gpio_set_level(LOCK_PIN, 0);
-        ESP_LOGI("LOCK", "Door relocked (PIN4 LOW)");
+        // Unlock for UNLOCK_DURATION_MS, or until the door is opened and closed
+        atomic_store(&door_opened, door_sensor_open());
+        unlock_started = xTaskGetTickCount();
+        lock_actuator_engage();
+        xTimerChangePeriod(relock_timer, pdMS_TO_TICKS(UNLOCK_DURATION_MS), 0);  // Also starts it
+        ESP_LOGI("LOCK", "Door unlocked for %d ms", UNLOCK_DURATION_MS);
     } else {
-        // Ensure locked state (pin LOW)
-        gpio_set_level(LOCK_PIN, 0);
+        // Relock now
+        xTimerStop(relock_timer, 0);
+        lock_actuator_release();
     }
-} 
+}
+ 
 
 
 // Menu Display
 static void display_menu(menu_state_t state) {
-    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-    vTaskDelay(pdMS_TO_TICKS(2));
-    
+    // Redrawn by effect_service() once the message expires
+    if (effect_message_held) {
+        return;
+    }
+    if (cred_table_failed) {
+        lcd_frame_template(&tmpl_cred_failed);
+        lcd_frame_publish();
+        return;
+    }
+
     switch(state) {
         case MAIN_MENU:
-            lcd_print_str("  1: Unlock");
-            lcd_set_cursor(0, 1);
-            lcd_print_str("2: Settings 3:Exit");
+            lcd_frame_template(&tmpl_main_menu);
             break;
             
         case UNLOCK_MODE:
-            lcd_print_str("  Enter Password:");
-            lcd_set_cursor(0, 1);
+            lcd_frame_template(&tmpl_unlock);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_frame_put(i, 1, LCD_GLYPH(GLYPH_DOT));
             }
             break;
             
         case SETTINGS_MENU:
-            lcd_print_str("  Settings Menu");
-            lcd_set_cursor(0, 1);
-            lcd_print_str("A:Master B:Guest C:Back");
+            lcd_frame_template(&tmpl_settings);
             break;
             
         case VERIFY_MASTER_PASSWORD:
-            lcd_print_str("  Master Password:");
-            lcd_set_cursor(0, 1);
+            lcd_frame_template(&tmpl_verify_master);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_frame_put(i, 1, LCD_GLYPH(GLYPH_DOT));
             }
             break;
             
         case CHANGE_MASTER_PASSWORD:
-            lcd_print_str("  New Master Pass:");
-            lcd_set_cursor(0, 1);
+            lcd_frame_template(&tmpl_new_master);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_frame_put(i, 1, LCD_GLYPH(GLYPH_DOT));
             }
             break;
             
         case CHANGE_GUEST_PASSWORD:
-            lcd_print_str("  New Guest Pass:");
-            lcd_set_cursor(0, 1);
+            lcd_frame_template(&tmpl_new_guest);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_frame_put(i, 1, LCD_GLYPH(GLYPH_DOT));
             }
             break;
             
         case LOCKED_STATE:
-            lcd_print_str("  System Locked");
+            lcd_frame_template(&tmpl_locked);
+            lcd_frame_put(0, 0, LCD_GLYPH(GLYPH_LOCK));
+            break;
+
+        case DOOR_UNLOCKED:
+            if (lock_system.extending) {
+                lcd_frame_template(&tmpl_extend);
+                for (int i = 0; i < lock_system.input_pos; i++) {
+                    lcd_frame_put(i, 1, LCD_GLYPH(GLYPH_DOT));
+                }
+                break;
+            }
+            // Each RELOCK_TICK_MS the bar loses one pixel, i.e. a single cell changes
+            lcd_frame_template(&tmpl_door_unlocked);
+            lcd_frame_put(0, 0, LCD_GLYPH(GLYPH_UNLOCK));
+            lcd_frame_bar(1, lock_remaining_ms(), UNLOCK_DURATION_MS);
             break;
     }
+
+    // Only the cells that changed since the last drawn frame reach the panel
+    lcd_frame_publish();
 }
 
 // Keypad Handling
 static void handle_keypress(char key) {
+    if (cred_table_failed) {
+        ESP_LOGW("CRED", "Key ignored, credential table unreadable");
+        display_menu(lock_system.state);
+        return;
+    }
+
     // Handle cancel button
     if (key == 'C') {
         if (lock_system.state == SETTINGS_MENU) {
@@ -344,6 +2688,14 @@ static void handle_keypress(char key) {
                    lock_system.state == CHANGE_MASTER_PASSWORD ||
                    lock_system.state == CHANGE_GUEST_PASSWORD) {
             lock_system.state = SETTINGS_MENU;
+        } else if (lock_system.state == DOOR_UNLOCKED && lock_system.extending) {
+            lock_system.extending = false;  // Back to the countdown, still unlocked
+        } else if (lock_system.state == DOOR_UNLOCKED) {
+            control_lock(false);
+            led_play(LED_MASTER, LED_PATTERN_OFF);
+            led_play(LED_GUEST, LED_PATTERN_OFF);
+            ESP_LOGI("LOCK", "Door relocked early");
+            lock_system.state = MAIN_MENU;
         } else {
             lock_system.state = MAIN_MENU;
         }
@@ -367,54 +2719,48 @@ static void handle_keypress(char key) {
             break;
             
         case UNLOCK_MODE:
-            if (key == '#') {
-                if (strcmp(lock_system.input_buffer, lock_system.master_password) == 0) {
+            if (key == '#' && rate_refuse(RATE_CH_KEYPAD)) {
+                lock_system.state = MAIN_MENU;
+                memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
+                lock_system.input_pos = 0;
+            } else if (key == '#') {
+                menu_state_t next = MAIN_MENU;
+                int id = cred_lookup(lock_system.input_buffer);
+                cred_role_t role = (id < 0) ? CRED_ROLE_NONE : cred_entry(id)->role;
+                if (role == CRED_ROLE_NONE && otp_verify(lock_system.input_buffer)) {
+                    role = CRED_ROLE_COURIER;  // Already redeemed, no table entry
+                }
+                if (role == CRED_ROLE_MASTER) {
                     control_lock(true);
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Access Granted!");
-                    
-                    // Blink master LED when master password is used
-                    for (int i = 0; i < 3; i++) {
-                        gpio_set_level(MASTER_LED_PIN, 1);
-                        vTaskDelay(pdMS_TO_TICKS(200));
-                        gpio_set_level(MASTER_LED_PIN, 0);
-                        vTaskDelay(pdMS_TO_TICKS(200));
-                    }
+                    next = DOOR_UNLOCKED;
+                    lcd_show_message_icon(&tmpl_access_granted, GLYPH_CHECK, 2000);
                     
-                    vTaskDelay(pdMS_TO_TICKS(2000));
-                } else if (strcmp(lock_system.input_buffer, lock_system.guest_password) == 0) {
-                    if (!lock_system.guest_password_used) {
+                    // Blink master LED when master password is used, breathe while open
+                    led_play(LED_MASTER, LED_PATTERN_UNLOCKED);
+                } else if (role == CRED_ROLE_GUEST || role == CRED_ROLE_COURIER) {
+                    if (id < 0 || !cred_spent(id)) {
                         control_lock(true);
-                        lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                        lcd_print_str("  Access Granted!");
+                        next = DOOR_UNLOCKED;
+                        lcd_show_message_icon(&tmpl_access_granted, GLYPH_CHECK, 2000);
                         
-                        // Blink guest LED when guest password is used
-                        for (int i = 0; i < 3; i++) {
-                            gpio_set_level(GUEST_LED_PIN, 1);
-                            vTaskDelay(pdMS_TO_TICKS(200));
-                            gpio_set_level(GUEST_LED_PIN, 0);
-                            vTaskDelay(pdMS_TO_TICKS(200));
+                        // Blink guest LED when guest password is used, breathe while open
+                        led_play(LED_GUEST, LED_PATTERN_UNLOCKED);
+                        if (id >= 0) {
+                            cred_consume(id);
                         }
-                        
-                        lock_system.guest_password_used = true;
-                        save_passwords();
-                        vTaskDelay(pdMS_TO_TICKS(2000));
                     } else {
-                        lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                        lcd_print_str("  Pass Used!");
-                        vTaskDelay(pdMS_TO_TICKS(2000));
+                        lcd_show_message(&tmpl_pass_used, 2000);
                     }
                 } else {
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Wrong Password!");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
+                    lcd_show_message_icon(&tmpl_wrong_password, GLYPH_CROSS, 2000);
                 }
-                lock_system.state = MAIN_MENU;
+                rate_record(RATE_CH_KEYPAD, next == DOOR_UNLOCKED, esp_timer_get_time() / 1000);
+                lock_system.state = next;
                 memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
                 lock_system.input_pos = 0;
             } else if (key == '*' && lock_system.input_pos > 0) {
                 lock_system.input_buffer[--lock_system.input_pos] = '\0';
-            } else if (key >= '0' && key <= '9' && lock_system.input_pos < 5) {
+            } else if (key >= '0' && key <= '9' && lock_system.input_pos < CRED_CODE_DIGITS) {
                 lock_system.input_buffer[lock_system.input_pos++] = key;
             }
             break;
@@ -438,8 +2784,15 @@ static void handle_keypress(char key) {
             break;
             
         case VERIFY_MASTER_PASSWORD:
-            if (key == '#') {
-                if (strcmp(lock_system.input_buffer, lock_system.master_password) == 0) {
+            if (key == '#' && rate_refuse(RATE_CH_KEYPAD)) {
+                lock_system.state = SETTINGS_MENU;
+                memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
+                lock_system.input_pos = 0;
+            } else if (key == '#') {
+                int id = cred_lookup(lock_system.input_buffer);
+                bool master = id >= 0 && cred_entry(id)->role == CRED_ROLE_MASTER;
+                rate_record(RATE_CH_KEYPAD, master, esp_timer_get_time() / 1000);
+                if (master) {
                     if (lock_system.last_key == 'A') {
                         lock_system.state = CHANGE_MASTER_PASSWORD;
                     } else if (lock_system.last_key == 'B') {
@@ -447,119 +2800,129 @@ static void handle_keypress(char key) {
                     }
                     memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
                     lock_system.input_pos = 0;
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Enter New Pass");
-                    vTaskDelay(pdMS_TO_TICKS(1000));
+                    lcd_show_message(&tmpl_enter_new_pass, 1000);
                 } else {
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Wrong Password!");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
+                    lcd_show_message_icon(&tmpl_wrong_password, GLYPH_CROSS, 2000);
                     lock_system.state = SETTINGS_MENU;
                 }
                 memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
                 lock_system.input_pos = 0;
             } else if (key == '*' && lock_system.input_pos > 0) {
                 lock_system.input_buffer[--lock_system.input_pos] = '\0';
-            } else if (key >= '0' && key <= '9' && lock_system.input_pos < 5) {
+            } else if (key >= '0' && key <= '9' && lock_system.input_pos < CRED_PIN_MAX) {
                 lock_system.input_buffer[lock_system.input_pos++] = key;
             }
             break;
             
         case CHANGE_MASTER_PASSWORD:
             if (key == '#') {
-                if (lock_system.input_pos >= 4) {
-                    strcpy(lock_system.master_password, lock_system.input_buffer);
-                    save_passwords();
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Pass Changed!");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
+                if (lock_system.input_pos < 4) {
+                    lcd_show_message(&tmpl_min_digits, 2000);
+                } else if (cred_put(CRED_ID_MASTER, lock_system.input_buffer, CRED_ROLE_MASTER, CRED_USES_UNLIMITED, 0) < 0) {
+                    lcd_show_message(&tmpl_pin_taken, 2000);
                 } else {
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Min 4 digits!");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
+                    lcd_show_message(&tmpl_pass_changed, 2000);
                 }
                 lock_system.state = SETTINGS_MENU;
                 memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
                 lock_system.input_pos = 0;
             } else if (key == '*' && lock_system.input_pos > 0) {
                 lock_system.input_buffer[--lock_system.input_pos] = '\0';
-            } else if (key >= '0' && key <= '9' && lock_system.input_pos < 5) {
+            } else if (key >= '0' && key <= '9' && lock_system.input_pos < CRED_PIN_MAX) {
                 lock_system.input_buffer[lock_system.input_pos++] = key;
             }
             break;
             
         case CHANGE_GUEST_PASSWORD:
             if (key == '#') {
-                if (lock_system.input_pos >= 4) {
-                    strcpy(lock_system.guest_password, lock_system.input_buffer);
-                    lock_system.guest_password_used = false;  // Reset the usage flag
-                    save_passwords();
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Pass Changed!");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
+                if (lock_system.input_pos < 4) {
+                    lcd_show_message(&tmpl_min_digits, 2000);
+                } else if (cred_put(CRED_ID_GUEST, lock_system.input_buffer, CRED_ROLE_GUEST, 1, 0) < 0) {  // One use again
+                    lcd_show_message(&tmpl_pin_taken, 2000);
                 } else {
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Min 4 digits!");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
+                    lcd_show_message(&tmpl_pass_changed, 2000);
                 }
                 lock_system.state = SETTINGS_MENU;
                 memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
                 lock_system.input_pos = 0;
             } else if (key == '*' && lock_system.input_pos > 0) {
                 lock_system.input_buffer[--lock_system.input_pos] = '\0';
-            } else if (key >= '0' && key <= '9' && lock_system.input_pos < 5) {
+            } else if (key >= '0' && key <= '9' && lock_system.input_pos < CRED_PIN_MAX) {
+                lock_system.input_buffer[lock_system.input_pos++] = key;
+            }
+            break;
+            
+        case DOOR_UNLOCKED:
+            // Only the master PIN, entered again now, extends the window
+            if (!lock_system.extending) {
+                if (key == 'A') {
+                    lock_system.extending = true;
+                    memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
+                    lock_system.input_pos = 0;
+                }
+            } else if (key == '#' && rate_refuse(RATE_CH_KEYPAD)) {
+                lock_system.extending = false;
+                memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
+                lock_system.input_pos = 0;
+            } else if (key == '#') {
+                int id = cred_lookup(lock_system.input_buffer);
+                bool master = id >= 0 && cred_entry(id)->role == CRED_ROLE_MASTER;
+                rate_record(RATE_CH_KEYPAD, master, esp_timer_get_time() / 1000);
+                if (!master) {
+                    lcd_show_message_icon(&tmpl_wrong_password, GLYPH_CROSS, 2000);
+                } else if (lock_extend()) {
+                    lcd_show_message_icon(&tmpl_extended, GLYPH_CHECK, 1000);
+                } else {
+                    lcd_show_message(&tmpl_max_window, 2000);
+                }
+                lock_system.extending = false;
+                memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
+                lock_system.input_pos = 0;
+            } else if (key == '*' && lock_system.input_pos > 0) {
+                lock_system.input_buffer[--lock_system.input_pos] = '\0';
+            } else if (key >= '0' && key <= '9' && lock_system.input_pos < CRED_PIN_MAX) {
                 lock_system.input_buffer[lock_system.input_pos++] = key;
             }
             break;
             
         case LOCKED_STATE:
-            if (key == '#') {
-                if (strcmp(lock_system.input_buffer, lock_system.master_password) == 0) {
+            if (key == '#' && rate_refuse(RATE_CH_KEYPAD)) {
+                memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
+                lock_system.input_pos = 0;
+            } else if (key == '#') {
+                int id = cred_lookup(lock_system.input_buffer);
+                cred_role_t role = (id < 0) ? CRED_ROLE_NONE : cred_entry(id)->role;
+                if (role == CRED_ROLE_NONE && otp_verify(lock_system.input_buffer)) {
+                    role = CRED_ROLE_COURIER;  // Already redeemed, no table entry
+                }
+                if (role == CRED_ROLE_MASTER) {
                     lock_system.state = MAIN_MENU;
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("System Unlocked");
+                    lcd_show_message(&tmpl_system_unlocked, 2000);
                     
                     // Blink master LED when master password is used
-                    for (int i = 0; i < 3; i++) {
-                        gpio_set_level(MASTER_LED_PIN, 1);
-                        vTaskDelay(pdMS_TO_TICKS(200));
-                        gpio_set_level(MASTER_LED_PIN, 0);
-                        vTaskDelay(pdMS_TO_TICKS(200));
-                    }
-                    
-                    vTaskDelay(pdMS_TO_TICKS(2000));
-                } else if (strcmp(lock_system.input_buffer, lock_system.guest_password) == 0) {
-                    if (!lock_system.guest_password_used) {
+                    led_play(LED_MASTER, LED_PATTERN_BLINK_3);
+                } else if (role == CRED_ROLE_GUEST || role == CRED_ROLE_COURIER) {
+                    if (id < 0 || !cred_spent(id)) {
                         lock_system.state = MAIN_MENU;
-                        lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                        lcd_print_str("System Unlocked");
+                        lcd_show_message(&tmpl_system_unlocked, 2000);
                         
                         // Blink guest LED when guest password is used
-                        for (int i = 0; i < 3; i++) {
-                            gpio_set_level(GUEST_LED_PIN, 1);
-                            vTaskDelay(pdMS_TO_TICKS(200));
-                            gpio_set_level(GUEST_LED_PIN, 0);
-                            vTaskDelay(pdMS_TO_TICKS(200));
+                        led_play(LED_GUEST, LED_PATTERN_BLINK_3);
+                        if (id >= 0) {
+                            cred_consume(id);
                         }
-                        
-                        lock_system.guest_password_used = true;
-                        save_passwords();
-                        vTaskDelay(pdMS_TO_TICKS(2000));
                     } else {
-                        lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                        lcd_print_str("  Guest Pass Used!");
-                        vTaskDelay(pdMS_TO_TICKS(2000));
+                        lcd_show_message(&tmpl_guest_pass_used, 2000);
                     }
                 } else {
-                    lcd_send_cmd(LCD_CLEAR_DISPLAY);
-                    lcd_print_str("  Wrong Password!");
-                    vTaskDelay(pdMS_TO_TICKS(2000));
+                    lcd_show_message_icon(&tmpl_wrong_password, GLYPH_CROSS, 2000);
                 }
+                rate_record(RATE_CH_KEYPAD, lock_system.state == MAIN_MENU, esp_timer_get_time() / 1000);
                 memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
                 lock_system.input_pos = 0;
             } else if (key == '*' && lock_system.input_pos > 0) {
                 lock_system.input_buffer[--lock_system.input_pos] = '\0';
-            } else if (key >= '0' && key <= '9' && lock_system.input_pos < 5) {
+            } else if (key >= '0' && key <= '9' && lock_system.input_pos < CRED_CODE_DIGITS) {
                 lock_system.input_buffer[lock_system.input_pos++] = key;
             }
             break;
@@ -571,32 +2934,501 @@ static void handle_keypress(char key) {
     display_menu(lock_system.state);
 }
 
+// Effect Scheduler
+// Message holds that used to block app_task in vTaskDelay are kept here as a
+// due time and expired by the app loop, whose notification wait sleeps until
+// then. Keys keep being handled, and typed ahead, while a message is shown.
+static void effect_service(void) {
+    if (effect_message_held && (int32_t)(xTaskGetTickCount() - effect_message_until) >= 0) {
+        effect_message_held = false;
+        display_menu(lock_system.state);
+    }
+}
+
+// Ticks until the held message expires
+static TickType_t effect_wait(void) {
+    if (!effect_message_held) {
+        return portMAX_DELAY;
+    }
+    TickType_t now = xTaskGetTickCount();
+    return ((int32_t)(effect_message_until - now) > 0) ? effect_message_until - now : 0;
+}
+
+// LED Pattern Engine
+// Each status LED is an LEDC channel. Fades run in the LEDC hardware; a
+// one-shot esp_timer per LED fires at the end of each step (fade plus hold)
+// and starts the next, so a pattern needs no task once led_play() returns.
+// Pattern changes are also made from that callback, which keeps all LED
+// state in the esp_timer task.
+static void led_init(void) {
+    ledc_timer_config_t timer = {
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .duty_resolution = LEDC_TIMER_10_BIT,
+        .timer_num = LEDC_TIMER_0,
+        .freq_hz = LED_PWM_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    ESP_ERROR_CHECK(ledc_timer_config(&timer));
+
+    for (int i = 0; i < LED_COUNT; i++) {
+        ledc_channel_config_t channel = {
+            .gpio_num = leds[i].pin,
+            .speed_mode = LEDC_LOW_SPEED_MODE,
+            .channel = leds[i].channel,
+            .timer_sel = LEDC_TIMER_0,
+            .duty = 0,
+            .hpoint = 0,
+        };
+        ESP_ERROR_CHECK(ledc_channel_config(&channel));
+
+        esp_timer_create_args_t args = {
+            .callback = led_step_done,
+            .arg = &leds[i],
+            .name = "led",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &leds[i].timer));
+    }
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+}
+
+static void led_step_start(led_state_t *led) {
+    const led_step_t *step = &led->pattern->steps[led->step];
+    uint32_t duty = step->duty_pct * LED_DUTY_MAX / 100;
+
+    if (step->fade_ms) {
+        ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, led->channel, duty, step->fade_ms);
+        ledc_fade_start(LEDC_LOW_SPEED_MODE, led->channel, LEDC_FADE_NO_WAIT);
+    } else {
+        ledc_set_duty(LEDC_LOW_SPEED_MODE, led->channel, duty);
+        ledc_update_duty(LEDC_LOW_SPEED_MODE, led->channel);
+    }
+
+    // A step with neither fade nor hold ends the pattern where it is
+    uint32_t step_ms = step->fade_ms + step->hold_ms;
+    if (step_ms) {
+        esp_timer_start_once(led->timer, step_ms * 1000ULL);
+    }
+}
+
+static void led_step_done(void *arg) {
+    led_state_t *led = arg;
+    int requested = atomic_exchange(&led->requested, 0);
+
+    if (requested) {
+        // The first step's duty or fade replaces whatever is running
+        led->pattern = &led_patterns[requested - 1];
+        led->step = 0;
+        led->pass = 0;
+    } else if (++led->step >= led->pattern->count) {
+        led->step = 0;
+        if (led->pattern->repeat && ++led->pass >= led->pattern->repeat) {
+            led->pattern = &led_patterns[led->pattern->next];
+            led->pass = 0;
+        }
+    }
+    led_step_start(led);
+}
+
+static void led_play(led_id_t id, led_pattern_id_t pattern) {
+    led_state_t *led = &leds[id];
+
+    atomic_store(&led->requested, pattern + 1);
+    // Cut the current step short; if the callback is running it re-arms the
+    // timer itself and the request is taken at the end of that step
+    esp_timer_stop(led->timer);
+    esp_timer_start_once(led->timer, 0);
+}
+
+// Key Latency Histograms
+// Each key press is timed through the pipeline: keypad_task stamps its onset
+// and capture, app_task its dequeue and handling, and lcd_render_task the
+// flush of the first frame published for it. Results are dumped from the
+// console task ('l' dumps, 'r' resets). A reset only bumps lat_generation:
+// the console never writes a histogram, its writer clears it on the next record.
+static void lat_record(lat_stage_t stage, int64_t us) {
+    lat_hist_t *hist = &lat_hist[stage];
+    uint32_t v = (us < 0) ? 0 : (us >= (1LL << LAT_MAX_LOG2)) ? (1u << LAT_MAX_LOG2) - 1 : (uint32_t)us;
+    uint32_t index = v;
+    uint32_t generation = atomic_load(&lat_generation);
+
+    if (hist->generation != generation) {
+        memset(hist, 0, sizeof(*hist));
+        hist->generation = generation;
+    }
+
+    if (v >= LAT_SUB) {
+        int log2 = 31 - __builtin_clz(v);
+        index = (log2 - LAT_SUB_BITS + 1) * LAT_SUB + ((v >> (log2 - LAT_SUB_BITS)) & (LAT_SUB - 1));
+    }
+    hist->buckets[index]++;
+    hist->count++;
+    if (v > hist->max_us) {
+        hist->max_us = v;
+    }
+}
+
+static void lat_record_frame(lcd_screen_t *screen) {
+    if (screen->key_onset_us == 0 || lcd_bus.state != LCD_BUS_OK) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    lat_record(LAT_RENDER, now - screen->published_us);
+    lat_record(LAT_TOTAL, now - screen->key_onset_us);
+    screen->key_onset_us = 0;  // Not again when redrawn after recovery
+}
+
+// Upper bound of the bucket holding the pct-th percentile
+static uint32_t lat_percentile(const lat_hist_t *hist, uint32_t pct) {
+    uint32_t target = (hist->count * pct + 99) / 100;
+    uint32_t seen = 0;
+
+    for (uint32_t i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target && seen > 0) {
+            if (i < LAT_SUB) {
+                return i;
+            }
+            int shift = i / LAT_SUB - 1;
+            uint32_t upper = ((LAT_SUB + i % LAT_SUB + 1) << shift) - 1;
+            return (upper < hist->max_us) ? upper : hist->max_us;
+        }
+    }
+    return 0;
+}
+
+static void lat_dump(void) {
+    static const char *const names[LAT_STAGES] = {
+        [LAT_DEBOUNCE] = "debounce",
+        [LAT_QUEUE] = "queue",
+        [LAT_HANDLE] = "handle",
+        [LAT_RENDER] = "render",
+        [LAT_TOTAL] = "total",
+    };
+
+    for (int stage = 0; stage < LAT_STAGES; stage++) {
+        static const lat_hist_t empty;
+        const lat_hist_t *hist = &lat_hist[stage];
+        if (hist->generation != atomic_load(&lat_generation)) {
+            hist = &empty;  // Reset, not recorded into since
+        }
+        ESP_LOGI("LATENCY", "%-8s n=%u p50=%u us p99=%u us max=%u us", names[stage],
+                 (unsigned)hist->count, (unsigned)lat_percentile(hist, 50),
+                 (unsigned)lat_percentile(hist, 99), (unsigned)hist->max_us);
+    }
+    ESP_LOGI("LATENCY", "key ring high-water=%u/%u dropped=%u coalesced=%u",
+             (unsigned)key_ring.high_water, KEY_RING_SIZE - 1,
+             (unsigned)key_ring.drops,
+             (unsigned)key_ring.coalesced);
+}
+
+static void console_read_line(char *line, size_t len) {
+    size_t n = 0;
+    uint8_t c;
+
+    while (uart_read_bytes(LAT_CONSOLE_UART, &c, 1, portMAX_DELAY) == 1 && c != '\n') {
+        if (c != '\r' && n < len - 1) {
+            line[n++] = c;
+        }
+    }
+    line[n] = '\0';
+}
+
+// Reads "<code> <from> <until>" and "g <count> <from> <until>" lines (Unix
+// times, until 0 = never) up to a "." line, then has app_task swap the batch in
+static void console_provision(void) {
+    cred_entry_t *staged = calloc(CRED_BATCH_MAX, sizeof(cred_entry_t));
+    char line[48], code[CRED_CODE_DIGITS + 2];  // One over, so an overlong code is rejected
+    unsigned long from, until;
+    int n = 0, count;
+
+    if (staged == NULL) {
+        ESP_LOGE("CRED", "No memory to stage a courier batch");
+        return;
+    }
+    ESP_LOGI("CRED", "Provisioning: '<code> <from> <until>' or 'g <count> <from> <until>', '.' to commit");
+    while (1) {
+        console_read_line(line, sizeof(line));
+        if (strcmp(line, ".") == 0) {
+            break;
+        } else if (sscanf(line, "g %d %lu %lu", &count, &from, &until) == 3) {
+            n = cred_batch_generate(staged, n, count, from, until);
+        } else if (sscanf(line, "%10s %lu %lu", code, &from, &until) == 3) {
+            n = cred_batch_add(staged, n, code, from, until);
+        } else if (line[0] != '\0') {
+            ESP_LOGW("CRED", "Ignored '%s'", line);
+        }
+    }
+
+    cred_batch_staged = staged;
+    cred_batch_staged_count = n;
+    xTaskNotify(app_task_handle, APP_NOTIFY_PROVISION, eSetBits);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ESP_LOGI("CRED", "Courier batch committed: %d of %d codes", cred_batch_staged_count, n);
+    free(staged);
+}
+
+void lat_console_task(void *pvParameter) {
+    uint8_t c;
+
+    uart_driver_install(LAT_CONSOLE_UART, 256, 0, 0, NULL, 0);
+    while (1) {
+        if (uart_read_bytes(LAT_CONSOLE_UART, &c, 1, portMAX_DELAY) != 1) {
+            continue;
+        }
+        if (c == 'l') {
+            lat_dump();
+        } else if (c == 'r') {
+            atomic_fetch_add(&lat_generation, 1);
+            ESP_LOGI("LATENCY", "Histograms reset");  // Key ring counters are kept
+        } else if (c == 'k') {
+            cred_calibrate();
+        } else if (c == 'p') {
+            console_provision();
+        } else if (c == 'o') {
+            otp_console();
+        } else if (c == 'n') {
+            nvs_cache_dump();
+        } else if (c == 'R') {
+            console_cred_reset();
+        }
+    }
+}
+
+// Key Event Ring
+// Replaces a FreeRTOS queue between keypad_task and app_task so the scanner
+// never blocks, whatever the app task is doing, and what happens on overflow
+// is chosen by KEY_RING_POLICY. The consumer sleeps on a task notification.
+static void key_ring_publish(const keypad_event_t *event) {
+    unsigned head = atomic_load_explicit(&key_ring.head, memory_order_relaxed);
+
+    // The slot is never the one at tail: the ring holds at most KEY_RING_SIZE - 1
+    key_ring.slots[head % KEY_RING_SIZE] = *event;
+    atomic_store_explicit(&key_ring.head, head + 1, memory_order_release);
+
+    unsigned depth = head + 1 - atomic_load_explicit(&key_ring.tail, memory_order_acquire);
+    if (depth > key_ring.high_water) {
+        key_ring.high_water = depth;
+    }
+    xTaskNotify(app_task_handle, APP_NOTIFY_KEYS, eSetBits);
+}
+
+static bool key_ring_full(void) {
+    unsigned head = atomic_load_explicit(&key_ring.head, memory_order_relaxed);
+    return head - atomic_load_explicit(&key_ring.tail, memory_order_acquire) >= KEY_RING_SIZE - 1;
+}
+
+// Producer side, never blocks. A coalesced overflow event goes out first
+// once there is room; with event NULL that is all it does.
+static void key_ring_push(const keypad_event_t *event) {
+    if (key_ring.has_pending && !key_ring_full()) {
+        key_ring_publish(&key_ring.pending);
+        key_ring.has_pending = false;
+    }
+    if (event == NULL) {
+        return;
+    }
+
+    // A held-back event still goes out first, so the new one waits behind it
+    bool full = key_ring.has_pending || key_ring_full();
+    if (full && KEY_RING_POLICY == KEY_RING_DROP_OLDEST) {
+        // Moving tail on fails only if the consumer just took that event,
+        // which makes room all the same
+        unsigned tail = atomic_load_explicit(&key_ring.tail, memory_order_acquire);
+        if (atomic_compare_exchange_strong_explicit(&key_ring.tail, &tail, tail + 1,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            key_ring.drops++;
+        }
+        full = false;
+    }
+
+    bool queued = true;
+    if (!full) {
+        key_ring_publish(event);
+    } else if (KEY_RING_POLICY == KEY_RING_COALESCE && key_ring.last_queued &&
+               event->key == key_ring.last.key && event->is_pressed == key_ring.last.is_pressed) {
+        key_ring.coalesced++;  // Repeats the queued event right before it, nothing is lost
+    } else if (KEY_RING_POLICY == KEY_RING_COALESCE && !key_ring.has_pending) {
+        key_ring.pending = *event;
+        key_ring.has_pending = true;
+    } else {
+        key_ring.drops++;
+        queued = false;
+        ESP_LOGW("KEYPAD", "Key ring full, dropped %c %s", event->key, event->is_pressed ? "press" : "release");
+    }
+    key_ring.last = *event;
+    key_ring.last_queued = queued;
+}
+
+// Consumer side. The slot only counts as read if tail still points at it
+// afterwards; if the producer dropped it meanwhile the compare-and-swap fails
+// and the next oldest event is read instead. The producer cannot reuse a slot
+// before tail has moved past it, so a successful swap means the copy is intact.
+static bool key_ring_pop(keypad_event_t *event) {
+    unsigned tail = atomic_load_explicit(&key_ring.tail, memory_order_acquire);
+
+    while (1) {
+        unsigned head = atomic_load_explicit(&key_ring.head, memory_order_acquire);
+        if (head == tail) {
+            return false;
+        }
+        *event = key_ring.slots[tail % KEY_RING_SIZE];
+        if (atomic_compare_exchange_weak_explicit(&key_ring.tail, &tail, tail + 1,
+                                                  memory_order_acq_rel, memory_order_acquire)) {
+            return true;
+        }
+    }
+}
+
 // Keypad Task
+// While idle every column is held low, so any key pulls its row low and the
+// row interrupt wakes the task. The matrix is then sampled every
+// SCAN_INTERVAL_MS until all keys are released and settled, and the rows are
+// re-armed.
+static void IRAM_ATTR keypad_isr_handler(void *arg) {
+    BaseType_t woken = pdFALSE;
+
+    for (int r = 0; r < ROWS; r++) {
+        gpio_intr_disable(row_pins[r]);
+    }
+    vTaskNotifyGiveFromISR(keypad_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static bool keypad_any_row_low(void) {
+    for (int r = 0; r < ROWS; r++) {
+        if (gpio_get_level(row_pins[r]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void keypad_wait_for_press(void) {
+    for (int c = 0; c < COLS; c++) {
+        gpio_set_level(col_pins[c], 0);
+    }
+
+    ulTaskNotifyTake(pdTRUE, 0);  // Drop a wake left over from the last scan
+    for (int r = 0; r < ROWS; r++) {
+        gpio_intr_enable(row_pins[r]);
+    }
+
+    // A key pressed before the rows were armed produced no edge
+    if (!keypad_any_row_low()) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    for (int r = 0; r < ROWS; r++) {
+        gpio_intr_disable(row_pins[r]);
+    }
+    for (int c = 0; c < COLS; c++) {
+        gpio_set_level(col_pins[c], 1);
+    }
+}
+
+// Reads the whole matrix, one bit per key, set while pressed. Rows are read
+// COLUMN_SETTLE_US after each column is driven, so a row still pulled low by
+// the previous column does not show up as a key in this one.
+static uint16_t keypad_sample(void) {
+    uint16_t raw = 0;
+
+    for (int c = 0; c < COLS; c++) {
+        gpio_set_level(col_pins[c], 0);
+        esp_rom_delay_us(COLUMN_SETTLE_US);
+        for (int r = 0; r < ROWS; r++) {
+            if (gpio_get_level(row_pins[r]) == 0) {
+                raw |= 1u << (r * COLS + c);
+            }
+        }
+        gpio_set_level(col_pins[c], 1);
+    }
+    return raw;
+}
+
+// Shifts one sample into every key's history. A key changes state only after
+// DEBOUNCE_SAMPLES equal samples, and each change is queued as its own event,
+// so keys are tracked independently and held keys do not hide others.
+// Returns false once every key is released and settled.
+static bool keypad_debounce(uint16_t raw) {
+    int64_t now = esp_timer_get_time();
+    bool settling = false;
+
+    for (int k = 0; k < ROWS * COLS; k++) {
+        uint16_t bit = 1u << k;
+        uint8_t settled = (keypad_stable & bit) ? DEBOUNCE_MASK : 0;
+        uint8_t history = ((keypad_history[k] << 1) | ((raw & bit) ? 1 : 0)) & DEBOUNCE_MASK;
+        if (keypad_history[k] == settled && history != settled) {
+            keypad_onset_us[k] = now;
+        }
+        keypad_history[k] = history;
+
+        bool pressed;
+        if (history == DEBOUNCE_MASK && !(keypad_stable & bit)) {
+            pressed = true;
+        } else if (history == 0 && (keypad_stable & bit)) {
+            pressed = false;
+        } else {
+            settling |= (history != 0);
+            continue;
+        }
+
+        keypad_stable ^= bit;
+        keypad_event_t event = {
+            .key = keymap[k / COLS][k % COLS],
+            .is_pressed = pressed,
+            .onset_us = keypad_onset_us[k],
+            .captured_us = now
+        };
+        key_ring_push(&event);
+    }
+
+    // Keep scanning while a coalesced event waits for room
+    key_ring_push(NULL);
+    return settling || keypad_stable != 0 || key_ring.has_pending;
+}
+
 void keypad_task(void *pvParameter) {
     while (1) {
-        for (int c = 0; c < COLS; c++) {
-            gpio_set_level(col_pins[c], 0);
-            
-            for (int r = 0; r < ROWS; r++) {
-                if (gpio_get_level(row_pins[r]) == 0) {
-                    vTaskDelay(pdMS_TO_TICKS(DEBOUNCE_DELAY_MS));
-                    if (gpio_get_level(row_pins[r]) == 0) {
-                        while (gpio_get_level(row_pins[r]) == 0) {
-                            vTaskDelay(pdMS_TO_TICKS(10));
-                        }
-                        
-                        keypad_event_t event = {
-                            .key = keymap[r][c],
-                            .is_pressed = true
-                        };
-                        xQueueSend(keypad_queue, &event, portMAX_DELAY);
-                    }
-                }
-            }
-            
-            gpio_set_level(col_pins[c], 1);
+        keypad_wait_for_press();
+
+        while (keypad_debounce(keypad_sample())) {
+            vTaskDelay(pdMS_TO_TICKS(SCAN_INTERVAL_MS));
+        }
+    }
+}
+
+// LCD Render Task
+// Owns the I2C bus after hardware_init. Frames published while a previous
+// one is still being drawn are coalesced, so only the latest reaches the panel.
+// The queue wait doubles as the timer for marquee steps and bus recovery.
+static TickType_t lcd_render_wait(void) {
+    if (lcd_bus.state == LCD_BUS_DOWN) {
+        // Due time is absolute so a stream of new frames cannot starve recovery
+        TickType_t now = xTaskGetTickCount();
+        return ((int32_t)(lcd_bus.retry_at - now) > 0) ? lcd_bus.retry_at - now : 0;
+    }
+    if (lcd_marquee.tmpl) {
+        return pdMS_TO_TICKS(LCD_MARQUEE_STEP_MS);
+    }
+    return portMAX_DELAY;
+}
+
+static void lcd_render_timeout(void) {
+    if (lcd_bus.state == LCD_BUS_DOWN) {
+        lcd_bus_recover();
+    } else if (lcd_marquee.tmpl) {
+        lcd_marquee_step();
+    }
+}
+
+void lcd_render_task(void *pvParameter) {
+    while (1) {
+        if (xQueueReceive(lcd_queue, &lcd_last, lcd_render_wait()) == pdTRUE) {
+            lcd_render(&lcd_last);
+            lat_record_frame(&lcd_last);
+        } else {
+            lcd_render_timeout();
         }
-        vTaskDelay(pdMS_TO_TICKS(SCAN_INTERVAL_MS));
     }
 }
 
@@ -604,26 +3436,91 @@ void keypad_task(void *pvParameter) {
 void app_task(void *pvParameter) {
     memset(&lock_system, 0, sizeof(lock_system));
     lock_system.state = MAIN_MENU;
-    hardware_init();
     load_passwords();
     display_menu(MAIN_MENU);
 
     keypad_event_t event;
+    uint32_t notified;
     while (1) {
-        if (xQueueReceive(keypad_queue, &event, portMAX_DELAY) == pdTRUE) {
+        // Wake for keys, the relock, a forced door, effects, and in DOOR_UNLOCKED for the countdown
+        TickType_t wait = effect_wait();
+        if (lock_system.state == DOOR_UNLOCKED && wait > pdMS_TO_TICKS(RELOCK_TICK_MS)) {
+            wait = pdMS_TO_TICKS(RELOCK_TICK_MS);
+        }
+        notified = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notified, wait);
+        effect_service();
+
+        // Skipped if an unlock restarted the timer after it expired
+        if ((notified & APP_NOTIFY_RELOCK) && !xTimerIsTimerActive(relock_timer)) {
+            lock_actuator_release();
+            ESP_LOGI("LOCK", "Door relocked");
+            led_play(LED_MASTER, LED_PATTERN_OFF);
+            led_play(LED_GUEST, LED_PATTERN_OFF);
+        }
+        if (notified & APP_NOTIFY_PROVISION) {
+            cred_batch_staged_count = cred_batch_apply(cred_batch_staged, cred_batch_staged_count);
+            xTaskNotifyGive(console_task_handle);
+        }
+        if (notified & APP_NOTIFY_OTP_SECRET) {
+            otp_set_secret(otp_secret_staged);
+            xTaskNotifyGive(console_task_handle);
+        }
+        if (notified & APP_NOTIFY_NVS_FLUSH) {
+            nvs_cache_flush();
+        }
+        if (notified & APP_NOTIFY_CRED_RESET) {
+            cred_table_reset();
+            lock_system.state = MAIN_MENU;
+            display_menu(MAIN_MENU);
+            xTaskNotifyGive(console_task_handle);
+        }
+        if (notified & APP_NOTIFY_FORCED) {
+            led_play(LED_MASTER, LED_PATTERN_STROBE);
+            lcd_show_message_icon(&tmpl_door_forced, GLYPH_CROSS, 3000);
+        }
+        if ((notified & APP_NOTIFY_RELOCK) && lock_system.state == DOOR_UNLOCKED &&
+            !xTimerIsTimerActive(relock_timer)) {
+            lock_system.state = MAIN_MENU;
+            lock_system.extending = false;
+            memset(lock_system.input_buffer, 0, sizeof(lock_system.input_buffer));
+            lock_system.input_pos = 0;
+            display_menu(MAIN_MENU);
+        } else if (lock_system.state == DOOR_UNLOCKED) {
+            display_menu(DOOR_UNLOCKED);
+        }
+
+        while (key_ring_pop(&event)) {
             if (event.is_pressed) {
+                int64_t dequeued_us = esp_timer_get_time();
+                lat_record(LAT_DEBOUNCE, event.captured_us - event.onset_us);
+                lat_record(LAT_QUEUE, dequeued_us - event.captured_us);
+
                 ESP_LOGI("KEYPAD", "Key pressed: %c", event.key);
+                lat_key_onset_us = event.onset_us;
                 handle_keypress(event.key);
+                lat_key_onset_us = 0;
+                lat_record(LAT_HANDLE, esp_timer_get_time() - dequeued_us);
             }
         }
     }
 }
 
 void app_main() {
-    keypad_queue = xQueueCreate(10, sizeof(keypad_event_t));
-    
-    xTaskCreate(keypad_task, "keypad_scan", 4096, NULL, 5, NULL);
-    xTaskCreate(app_task, "app_task", 8192, NULL, 4, NULL);
+    lcd_queue = xQueueCreate(1, sizeof(lcd_screen_t));
+    relock_timer = xTimerCreate("relock", pdMS_TO_TICKS(UNLOCK_DURATION_MS), pdFALSE, NULL, relock_timer_callback);
+    door_timer = xTimerCreate("door", pdMS_TO_TICKS(DOOR_DEBOUNCE_MS), pdFALSE, NULL, door_timer_callback);
+    nvs_cache_timer = xTimerCreate("nvs_cache", pdMS_TO_TICKS(NVS_CACHE_DEFER_MS), pdFALSE, NULL,
+                                   nvs_cache_timer_callback);
+
+    // Pins, NVS and the panel are ready before any task can scan, notify or draw
+    hardware_init();
+
+    xTaskCreate(app_task, "app_task", 8192, NULL, 4, &app_task_handle);
+    xTaskCreate(keypad_task, "keypad_scan", 4096, NULL, 5, &keypad_task_handle);
+    xTaskCreate(lcd_render_task, "lcd_render", 4096, NULL, 3, NULL);
+    xTaskCreate(lat_console_task, "lat_console", 4096, NULL, 1, &console_task_handle);
+    door_sensor_arm();
     
     ESP_LOGI("MAIN", "Digital Lock System Started");
 }
@@ -50,6 +50,8 @@ static const char keymap[ROWS][COLS] = {
 #define LCD_BACKLIGHT 0x08
 #define LCD_DATA 0x01
 #define LCD_COMMAND 0x00
+#define LCD_ENABLE  0x04
+#define LCD_BATCH_MAX 40  // HD44780 bytes per I2C transaction
 
 // Menu States
 typedef enum {
@@ -81,12 +83,35 @@ typedef struct {
     bool guest_password_used;   // Flag to track if guest password has been used
 } lock_system_t;
 
+// Batched LCD transport buffer, up to LCD_BATCH_MAX HD44780 bytes per transaction
+typedef struct {
+    uint8_t buf[LCD_BATCH_MAX * 4];
+    size_t len;
+} lcd_batch_t;
+
+// LCD bus counters (totals since boot and for the screen being drawn)
+typedef struct {
+    uint32_t total_bytes;
+    uint32_t total_transactions;
+    uint32_t screen_bytes;
+    uint32_t screen_transactions;
+} lcd_stats_t;
+
 // Global Variables
+static lcd_stats_t lcd_stats;
 static QueueHandle_t keypad_queue;
 static lock_system_t lock_system;
 static nvs_handle_t nvs_handler;
 
 // Function Declarations
+static void lcd_batch_flush(lcd_batch_t *batch);
+static void lcd_batch_push(lcd_batch_t *batch, uint8_t value, uint8_t mode);
+static void lcd_batch_cmd(lcd_batch_t *batch, uint8_t cmd);
+static void lcd_batch_data(lcd_batch_t *batch, uint8_t data);
+static void lcd_batch_set_cursor(lcd_batch_t *batch, uint8_t col, uint8_t row);
+static void lcd_batch_str(lcd_batch_t *batch, const char *str);
+static void lcd_stats_begin_screen(void);
+static void lcd_stats_end_screen(const char *name);
 static void lcd_send_cmd(uint8_t cmd);
 static void lcd_send_data(uint8_t data);
 static void lcd_init(void);
@@ -101,43 +126,89 @@ static void handle_keypress(char key);
 void keypad_task(void *pvParameter);
 void app_task(void *pvParameter);
 
-// LCD Functions
-static void lcd_send_cmd(uint8_t cmd) {
-    uint8_t data_u = (cmd & 0xF0) | LCD_BACKLIGHT;
-    uint8_t data_l = ((cmd << 4) & 0xF0) | LCD_BACKLIGHT;
-    
-    uint8_t buf[4];
-    buf[0] = data_u | 0x04;
-    buf[1] = data_u & ~0x04;
-    buf[2] = data_l | 0x04;
-    buf[3] = data_l & ~0x04;
-    
+// LCD Batch Transport
+// Every HD44780 byte goes out as 4 PCF8574 bytes (high nibble then low nibble,
+// each strobed EN high/low). Queuing them in one buffer lets a whole line or
+// screen be written in a single I2C transaction instead of one per character.
+static void lcd_batch_flush(lcd_batch_t *batch) {
+    if (batch->len == 0) {
+        return;
+    }
+
     i2c_cmd_handle_t cmd_handle = i2c_cmd_link_create();
     i2c_master_start(cmd_handle);
     i2c_master_write_byte(cmd_handle, (LCD_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write(cmd_handle, buf, 4, true);
+    i2c_master_write(cmd_handle, batch->buf, batch->len, true);
     i2c_master_stop(cmd_handle);
     i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(1000));
     i2c_cmd_link_delete(cmd_handle);
+
+    // Address byte + payload
+    lcd_stats.total_bytes += batch->len + 1;
+    lcd_stats.total_transactions++;
+    lcd_stats.screen_bytes += batch->len + 1;
+    lcd_stats.screen_transactions++;
+    batch->len = 0;
+}
+
+static void lcd_batch_push(lcd_batch_t *batch, uint8_t value, uint8_t mode) {
+    if (batch->len + 4 > sizeof(batch->buf)) {
+        lcd_batch_flush(batch);
+    }
+
+    uint8_t data_u = (value & 0xF0) | LCD_BACKLIGHT | mode;
+    uint8_t data_l = ((value << 4) & 0xF0) | LCD_BACKLIGHT | mode;
+
+    batch->buf[batch->len++] = data_u | LCD_ENABLE;
+    batch->buf[batch->len++] = data_u & ~LCD_ENABLE;
+    batch->buf[batch->len++] = data_l | LCD_ENABLE;
+    batch->buf[batch->len++] = data_l & ~LCD_ENABLE;
+}
+
+static void lcd_batch_cmd(lcd_batch_t *batch, uint8_t cmd) {
+    lcd_batch_push(batch, cmd, LCD_COMMAND);
+}
+
+static void lcd_batch_data(lcd_batch_t *batch, uint8_t data) {
+    lcd_batch_push(batch, data, LCD_DATA);
+}
+
+static void lcd_batch_set_cursor(lcd_batch_t *batch, uint8_t col, uint8_t row) {
+    uint8_t row_offsets[] = {0x00, 0x40};
+    if (row >= LCD_ROWS) {
+        row = LCD_ROWS - 1;
+    }
+    lcd_batch_cmd(batch, LCD_SET_DDRAM_ADDR | (col + row_offsets[row]));
+}
+
+static void lcd_batch_str(lcd_batch_t *batch, const char *str) {
+    while (*str) {
+        lcd_batch_data(batch, *str++);
+    }
+}
+
+static void lcd_stats_begin_screen(void) {
+    lcd_stats.screen_bytes = 0;
+    lcd_stats.screen_transactions = 0;
+}
+
+static void lcd_stats_end_screen(const char *name) {
+    ESP_LOGD("LCD", "%s: %u bytes in %u transactions (total %u / %u)", name,
+             (unsigned)lcd_stats.screen_bytes, (unsigned)lcd_stats.screen_transactions,
+             (unsigned)lcd_stats.total_bytes, (unsigned)lcd_stats.total_transactions);
+}
+
+// LCD Functions
+static void lcd_send_cmd(uint8_t cmd) {
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_cmd(&batch, cmd);
+    lcd_batch_flush(&batch);
 }
 
 static void lcd_send_data(uint8_t data) {
-    uint8_t data_u = (data & 0xF0) | LCD_BACKLIGHT | LCD_DATA;
-    uint8_t data_l = ((data << 4) & 0xF0) | LCD_BACKLIGHT | LCD_DATA;
-    
-    uint8_t buf[4];
-    buf[0] = data_u | 0x04;
-    buf[1] = data_u & ~0x04;
-    buf[2] = data_l | 0x04;
-    buf[3] = data_l & ~0x04;
-    
-    i2c_cmd_handle_t cmd_handle = i2c_cmd_link_create();
-    i2c_master_start(cmd_handle);
-    i2c_master_write_byte(cmd_handle, (LCD_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write(cmd_handle, buf, 4, true);
-    i2c_master_stop(cmd_handle);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(1000));
-    i2c_cmd_link_delete(cmd_handle);
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_data(&batch, data);
+    lcd_batch_flush(&batch);
 }
 
 static void lcd_init(void) {
@@ -158,17 +229,15 @@ static void lcd_init(void) {
 }
 
 static void lcd_set_cursor(uint8_t col, uint8_t row) {
-    uint8_t row_offsets[] = {0x00, 0x40};
-    if (row >= LCD_ROWS) {
-        row = LCD_ROWS - 1;
-    }
-    lcd_send_cmd(LCD_SET_DDRAM_ADDR | (col + row_offsets[row]));
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_set_cursor(&batch, col, row);
+    lcd_batch_flush(&batch);
 }
 
 static void lcd_print_str(const char *str) {
-    while (*str) {
-        lcd_send_data(*str++);
-    }
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_str(&batch, str);
+    lcd_batch_flush(&batch);
 }
 
 // Password Management
@@ -270,58 +339,65 @@ static void control_lock(bool unlock) {
 
 // Menu Display
 static void display_menu(menu_state_t state) {
+    lcd_batch_t batch = { .len = 0 };
+    lcd_stats_begin_screen();
+
     lcd_send_cmd(LCD_CLEAR_DISPLAY);
     vTaskDelay(pdMS_TO_TICKS(2));
     
     switch(state) {
         case MAIN_MENU:
-            lcd_print_str("  1: Unlock");
-            lcd_set_cursor(0, 1);
-            lcd_print_str("2: Settings 3:Exit");
+            lcd_batch_str(&batch, "  1: Unlock");
+            lcd_batch_set_cursor(&batch, 0, 1);
+            lcd_batch_str(&batch, "2: Settings 3:Exit");
             break;
             
         case UNLOCK_MODE:
-            lcd_print_str("  Enter Password:");
-            lcd_set_cursor(0, 1);
+            lcd_batch_str(&batch, "  Enter Password:");
+            lcd_batch_set_cursor(&batch, 0, 1);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_batch_data(&batch, '*');
             }
             break;
             
         case SETTINGS_MENU:
-            lcd_print_str("  Settings Menu");
-            lcd_set_cursor(0, 1);
-            lcd_print_str("A:Master B:Guest C:Back");
+            lcd_batch_str(&batch, "  Settings Menu");
+            lcd_batch_set_cursor(&batch, 0, 1);
+            lcd_batch_str(&batch, "A:Master B:Guest C:Back");
             break;
             
         case VERIFY_MASTER_PASSWORD:
-            lcd_print_str("  Master Password:");
-            lcd_set_cursor(0, 1);
+            lcd_batch_str(&batch, "  Master Password:");
+            lcd_batch_set_cursor(&batch, 0, 1);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_batch_data(&batch, '*');
             }
             break;
             
         case CHANGE_MASTER_PASSWORD:
-            lcd_print_str("  New Master Pass:");
-            lcd_set_cursor(0, 1);
+            lcd_batch_str(&batch, "  New Master Pass:");
+            lcd_batch_set_cursor(&batch, 0, 1);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_batch_data(&batch, '*');
             }
             break;
             
         case CHANGE_GUEST_PASSWORD:
-            lcd_print_str("  New Guest Pass:");
-            lcd_set_cursor(0, 1);
+            lcd_batch_str(&batch, "  New Guest Pass:");
+            lcd_batch_set_cursor(&batch, 0, 1);
             for (int i = 0; i < lock_system.input_pos; i++) {
-                lcd_print_str("*");
+                lcd_batch_data(&batch, '*');
             }
             break;
             
         case LOCKED_STATE:
-            lcd_print_str("  System Locked");
+            lcd_batch_str(&batch, "  System Locked");
             break;
     }
+
+    // Whole screen goes out as one transaction
+    lcd_batch_flush(&batch);
+    lcd_stats_end_screen("menu");
 }
 
 // Keypad Handling
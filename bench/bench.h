@@ -0,0 +1,114 @@
+// Host-side LCD benchmark: shared declarations between the fake bus and the
+// wrappers that compile the firmware sources.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Everything the fake bus has seen since the last bench_counters_reset()
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;       // Address byte included
+    uint64_t bus_us;      // Modelled SCL time at the configured clk_speed
+    uint64_t delay_us;    // Time spent in vTaskDelay
+} bench_counters_t;
+
+extern bench_counters_t bench_counters;
+
+// NVS traffic since the last bench_nvs_reset()
+typedef struct {
+    uint32_t sets;
+    uint32_t bytes;
+    uint32_t commits;
+} bench_nvs_t;
+
+extern bench_nvs_t bench_nvs;
+void bench_nvs_reset(void);
+
+// Flash traffic on the fake "consumed" partition since bench_flash_reset()
+typedef struct {
+    uint32_t writes;
+    uint32_t bytes;
+    uint32_t erases;
+} bench_flash_t;
+
+extern bench_flash_t bench_flash;
+void bench_flash_reset(void);
+
+void bench_counters_reset(void);
+void bench_set_idle_hook(void (*hook)(void));
+void bench_set_bus_stuck(bool stuck);
+uint64_t bench_now_us(void);
+void bench_set_key(int row_gpio, int col_gpio, bool down);
+void bench_visible_screen(char out[2][17]);
+
+// Final.c
+#define FINAL_BENCH_STATES 8
+void final_bench_init(void);
+const char *final_bench_state_name(int state);
+int final_bench_is_pin_entry(int state);
+void final_bench_show(int state, int input_pos);
+void final_bench_key(char key);
+void final_bench_idle(uint32_t ms);
+void final_bench_bus_health(uint32_t *errors, uint32_t *trips, uint32_t *recoveries, bool *down);
+double final_bench_verify_us(const char *guess, bool *ok);
+typedef struct {
+    double insert_ns;
+    double hit_ns;
+    double miss_ns;
+    double probes;        // Average slots visited per hit
+    double rebuild_us;    // Boot-time index rebuild
+    uint32_t ram_bytes;   // Entries only
+    uint32_t table_max;   // CRED_TABLE_MAX of the build measured
+    uint32_t dram_bytes;  // Its cred_entries, cred_batch and cred_index
+} final_bench_cred_t;
+void final_bench_cred_table(uint32_t n, final_bench_cred_t *out);
+uint32_t final_bench_cred_capacity(void);
+void final_bench_cred_table_large(uint32_t n, final_bench_cred_t *out);  // bench_final_large.c
+double final_bench_provision_ms(int codes, int *stored, double *apply_ms);
+void final_bench_otp_reset(void);
+double final_bench_otp_verify_us(const char *input, bool *ok);
+int final_bench_otp_window(void);
+void final_bench_consumed_mark_all(int *marked, int *spent);
+int final_bench_consumed_cycle(int batches);
+int final_bench_consumed_reopen(void);
+enum {
+    FINAL_BENCH_ATTACK_GREEDY,   // Each attempt as soon as the lockout ends
+    FINAL_BENCH_ATTACK_BURST,    // Waits for a full bucket, then empties it
+    FINAL_BENCH_ATTACK_TRICKLE,  // Spends refills but never empties the bucket
+    FINAL_BENCH_ATTACK_HAMMER,   // One attempt a second, refused or not
+    FINAL_BENCH_ATTACK_POWER,    // Greedy, cutting power after every attempt
+    FINAL_BENCH_ATTACKS
+};
+void final_bench_rate_attack(int attack, int days, uint32_t *per_day, uint32_t *nvs_writes);
+int final_bench_rate_burst(void);
+typedef struct {
+    uint32_t pins;          // Master/guest PINs in the table
+    uint32_t pin_space;     // Of the shortest PIN the settings menu takes
+    uint32_t code_space;    // Courier codes
+    uint32_t otp_window;    // One-time codes accepted at any moment
+    uint32_t otp_space;
+} final_bench_live_t;
+void final_bench_live(final_bench_live_t *out);
+typedef struct {
+    uint32_t saved;         // Records the owners saved (one nvs_set each without the cache)
+    uint32_t save_points;   // Their save points (one nvs_commit each)
+    uint32_t written;       // Records the cache wrote
+    uint32_t skipped;       // Saved but unchanged
+    uint32_t commits;
+    uint32_t bytes;         // As counted by the fake NVS
+} final_bench_nvs_t;
+void final_bench_nvs_session(final_bench_nvs_t *out);
+uint32_t final_bench_kdf_iterations(void);
+uint32_t final_bench_verify_budget_ms(void);
+
+// keypad-LCD.c
+void klcd_bench_init(void);
+void klcd_bench_send_cmd(uint8_t cmd);
+void klcd_bench_send_data(uint8_t data);
+void klcd_bench_print_str(const char *str);
+void klcd_bench_update_lcd(void);
+void klcd_bench_key(char key);
+void klcd_bench_hold_key(int row, int col, bool down);
+void klcd_bench_scan_tick(void);
+bool klcd_bench_event(char *key, bool *pressed);
@@ -0,0 +1,75 @@
+// Credential index bench over Final.c's statics. Included right after
+// ../Final.c by bench_final.c, built at the device's CRED_TABLE_MAX, and by
+// bench_final_large.c, built with a table large enough for 10k entries.
+#ifndef BENCH_CRED_TABLE_H
+#define BENCH_CRED_TABLE_H
+
+#include <time.h>
+
+#include "bench.h"
+
+static double elapsed_us(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e6 + (end.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+// Index cost at a table size, KDF excluded: fills the table with n random
+// digests, then looks up stored (hit) and unstored (miss) digests. Leaves
+// the table holding them.
+static void bench_cred_table(uint32_t n, final_bench_cred_t *out) {
+    static uint8_t digests[CRED_TABLE_MAX][CRED_DIGEST_LEN];
+    static uint8_t misses[1024][CRED_DIGEST_LEN];
+    const uint32_t lookups = 200000;
+    uint32_t reps = n < 200000 ? 200000 / n : 1;
+    struct timespec start;
+    volatile int sink = 0;
+    uint64_t probes = 0;
+
+    esp_fill_random(misses, sizeof(misses));
+    out->insert_ns = 0;
+    for (uint32_t r = 0; r < reps; r++) {
+        cred_hdr.used = 0;
+        cred_hdr.count = 0;
+        memset(cred_entries, 0, sizeof(cred_entries));
+        memset(cred_index, 0, sizeof(cred_index));
+        esp_fill_random(digests, n * CRED_DIGEST_LEN);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint32_t i = 0; i < n; i++) {
+            sink += cred_insert(-1, digests[i], CRED_ROLE_GUEST, CRED_USES_UNLIMITED, 0);
+        }
+        out->insert_ns += elapsed_us(&start) * 1000.0 / n;
+    }
+    out->insert_ns /= reps;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < lookups; i++) {
+        sink += cred_find(digests[i % n]);
+    }
+    out->hit_ns = elapsed_us(&start) * 1000.0 / lookups;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < lookups; i++) {
+        sink += cred_find(misses[i % 1024]);
+    }
+    out->miss_ns = elapsed_us(&start) * 1000.0 / lookups;
+
+    // Slots visited per hit, the home slot counting as one
+    for (uint32_t slot = 0; slot < CRED_INDEX_SIZE; slot++) {
+        if (cred_index[slot]) {
+            probes += ((slot - cred_home(cred_entries[cred_index[slot] - 1].digest)) & (CRED_INDEX_SIZE - 1)) + 1;
+        }
+    }
+    out->probes = (double)probes / cred_hdr.count;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cred_index_rebuild();
+    out->rebuild_us = elapsed_us(&start);
+    out->ram_bytes = cred_hdr.count * sizeof(cred_entry_t);
+    out->table_max = CRED_TABLE_MAX;
+    out->dram_bytes = sizeof(cred_entries) + sizeof(cred_batch) + sizeof(cred_index);
+    (void)sink;
+}
+
+#endif
@@ -0,0 +1,303 @@
+// Final.c built against the fake backend. lcd_render_task never runs on the
+// host; instead its loop body runs once per simulated tick while the firmware
+// sleeps, and whenever control returns to the benchmark.
+#define app_main final_app_main
+#define app_task final_app_task
+#define keypad_task final_keypad_task
+#define lcd_render_task final_lcd_render_task
+#define row_pins final_row_pins
+#define col_pins final_col_pins
+#include "../Final.c"
+
+#include <time.h>
+
+#include "bench.h"
+#include "bench_cred_table.h"
+
+static TickType_t render_deadline = portMAX_DELAY;  // When lcd_render_task's queue wait would time out
+
+static const char *const state_names[FINAL_BENCH_STATES] = {
+    [MAIN_MENU] = "MAIN_MENU",
+    [UNLOCK_MODE] = "UNLOCK_MODE",
+    [SETTINGS_MENU] = "SETTINGS_MENU",
+    [CHANGE_MASTER_PASSWORD] = "CHANGE_MASTER_PASSWORD",
+    [CHANGE_GUEST_PASSWORD] = "CHANGE_GUEST_PASSWORD",
+    [VERIFY_MASTER_PASSWORD] = "VERIFY_MASTER_PASSWORD",
+    [LOCKED_STATE] = "LOCKED_STATE",
+    [DOOR_UNLOCKED] = "DOOR_UNLOCKED",
+};
+
+_Static_assert(DOOR_UNLOCKED + 1 == FINAL_BENCH_STATES, "menu_state_t changed");
+
+// One tick of lcd_render_task: take a pending frame, else fire the queue
+// wait timeout (marquee step, bus recovery) once it is due
+static void final_bench_render(void) {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait;
+
+    if (xQueueReceive(lcd_queue, &lcd_last, 0) == pdTRUE) {
+        lcd_render(&lcd_last);
+    } else if (render_deadline != portMAX_DELAY && (int32_t)(now - render_deadline) >= 0) {
+        lcd_render_timeout();
+    } else {
+        return;
+    }
+
+    wait = lcd_render_wait();
+    render_deadline = (wait == portMAX_DELAY) ? portMAX_DELAY : xTaskGetTickCount() + wait;
+}
+
+void final_bench_init(void) {
+    final_app_main();
+
+    // app_task's start-up, without its receive loop
+    memset(&lock_system, 0, sizeof(lock_system));
+    lock_system.state = MAIN_MENU;
+    load_passwords();
+    display_menu(MAIN_MENU);
+
+    bench_set_idle_hook(final_bench_render);
+    final_bench_render();
+}
+
+const char *final_bench_state_name(int state) {
+    return state_names[state];
+}
+
+int final_bench_is_pin_entry(int state) {
+    return state == UNLOCK_MODE || state == VERIFY_MASTER_PASSWORD ||
+           state == CHANGE_MASTER_PASSWORD || state == CHANGE_GUEST_PASSWORD;
+}
+
+void final_bench_show(int state, int input_pos) {
+    lock_system.input_pos = input_pos;
+    display_menu((menu_state_t)state);
+    final_bench_render();
+}
+
+// Runs the key, then app_task's effect timeouts until no effect is pending,
+// so the sleep column is how long the key's feedback lasts
+void final_bench_key(char key) {
+    TickType_t wait;
+
+    handle_keypress(key);
+    final_bench_render();
+    while ((wait = effect_wait()) != portMAX_DELAY) {
+        vTaskDelay(wait);
+        effect_service();
+        final_bench_render();
+    }
+}
+
+void final_bench_idle(uint32_t ms) {
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void final_bench_bus_health(uint32_t *errors, uint32_t *trips, uint32_t *recoveries, bool *down) {
+    *errors = lcd_bus.errors;
+    *trips = lcd_bus.trips;
+    *recoveries = lcd_bus.recoveries;
+    *down = lcd_bus.state != LCD_BUS_OK;
+}
+
+// Wall-clock time of one cred_lookup against the table from load_passwords
+// (master "1234"), KDF included
+double final_bench_verify_us(const char *guess, bool *ok) {
+    struct timespec start;
+    int id;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    id = cred_lookup(guess);
+    *ok = id >= 0;
+    return elapsed_us(&start);
+}
+
+// Index cost at the device's CRED_TABLE_MAX, up to a full table
+void final_bench_cred_table(uint32_t n, final_bench_cred_t *out) {
+    bench_cred_table(n, out);
+
+    // Leave the keypad credentials as load_passwords made them
+    memset(&cred_hdr, 0, sizeof(cred_hdr));
+    load_passwords();
+}
+
+// Entries a table built by cred_insert(-1, ...) holds, past the settings-menu ids
+uint32_t final_bench_cred_capacity(void) {
+    return CRED_TABLE_MAX - (CRED_ID_GUEST + 1);
+}
+
+uint32_t final_bench_kdf_iterations(void) {
+    return CRED_KDF_ITERATIONS;
+}
+
+uint32_t final_bench_verify_budget_ms(void) {
+    return CRED_VERIFY_BUDGET_MS;
+}
+
+// Wall-clock time to stage codes random courier codes as console_provision
+// does (RNG and KDF), with the app_task apply and its NVS write timed apart
+double final_bench_provision_ms(int codes, int *stored, double *apply_ms) {
+    cred_entry_t *staged = calloc(CRED_BATCH_MAX, sizeof(cred_entry_t));
+    struct timespec start;
+    double stage_ms;
+    int n;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n = cred_batch_generate(staged, 0, codes, 0, 0);
+    stage_ms = elapsed_us(&start) / 1000.0;
+
+    bench_nvs_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *stored = cred_batch_apply(staged, n);
+    *apply_ms = elapsed_us(&start) / 1000.0;
+    free(staged);
+    return stage_ms;
+}
+
+// Redeems every code of the current batch as handle_keypress does, then
+// counts how many now read as spent
+void final_bench_consumed_mark_all(int *marked, int *spent) {
+    *marked = cred_batch.count;
+    *spent = 0;
+    for (int i = 0; i < cred_batch.count; i++) {
+        cred_consume(CRED_TABLE_MAX + i);
+    }
+    for (int i = 0; i < cred_batch.count; i++) {
+        *spent += cred_spent(CRED_TABLE_MAX + i);
+    }
+}
+
+// Applies batches empty batches; returns the sector erases they cost
+int final_bench_consumed_cycle(int batches) {
+    uint32_t before = consumed_erases;
+
+    for (int i = 0; i < batches; i++) {
+        cred_batch_apply(NULL, 0);
+    }
+    return consumed_erases - before;
+}
+
+// Marks the odd slots, drops the RAM copy and reopens from flash as a boot
+// would; returns the slots whose state came back wrong
+int final_bench_consumed_reopen(void) {
+    int wrong = 0;
+
+    for (int i = 1; i < CRED_BATCH_MAX; i += 2) {
+        consumed_mark(i);
+    }
+    memset(consumed_bits, 0, sizeof(consumed_bits));
+    consumed_open(cred_batch.id);
+    for (int i = 0; i < CRED_BATCH_MAX; i++) {
+        wrong += consumed_test(i) != (i % 2 == 1);
+    }
+    return wrong;
+}
+
+// Wrong keypad PINs only, against a clean bucket, for days of simulated time
+// on the limiter's own clock. Attempts the limiter let through are counted
+// per day.
+void final_bench_rate_attack(int attack, int days, uint32_t *per_day, uint32_t *nvs_writes) {
+    const int64_t day_ms = 24LL * 60 * 60 * 1000;
+    rate_bucket_t *bucket = &rate_rtc.buckets[RATE_CH_KEYPAD];
+    int64_t now = 0;
+    bool spending = false;
+
+    nvs_erase_key(nvs_handler, "rate_state");
+    rate_rtc.magic = 0;
+    rate_load(now);
+    rate_nvs_writes = 0;
+    memset(per_day, 0, days * sizeof(per_day[0]));
+
+    while (now < days * day_ms) {
+        uint32_t wait = rate_wait_ms(RATE_CH_KEYPAD, now);
+        if (attack == FINAL_BENCH_ATTACK_HAMMER) {
+            if (wait == 0) {
+                rate_record(RATE_CH_KEYPAD, false, now);
+                per_day[now / day_ms]++;
+            }
+            now += 1000;
+            continue;
+        }
+        if (wait > 0) {
+            now += wait;
+            continue;
+        }
+        if ((attack == FINAL_BENCH_ATTACK_BURST && bucket->tokens < RATE_BURST && !spending) ||
+            (attack == FINAL_BENCH_ATTACK_TRICKLE && bucket->tokens < 2)) {
+            now = bucket->refilled_ms + RATE_REFILL_MS;
+            continue;
+        }
+        rate_record(RATE_CH_KEYPAD, false, now);
+        spending = bucket->tokens > 0;
+        per_day[now / day_ms]++;
+        if (attack == FINAL_BENCH_ATTACK_POWER) {
+            now += 2000;  // Boot
+            rate_rtc.magic = 0;
+            rate_load(now);
+        }
+    }
+    *nvs_writes = rate_nvs_writes;
+}
+
+int final_bench_rate_burst(void) {
+    return RATE_BURST;
+}
+
+// What a keypad guess can hit besides the courier batch, whose size the
+// caller knows from provisioning
+void final_bench_live(final_bench_live_t *out) {
+    out->pins = 0;
+    for (int id = CRED_ID_MASTER; id <= CRED_ID_GUEST; id++) {
+        out->pins += cred_entries[id].role != CRED_ROLE_NONE;
+    }
+    out->pin_space = 10000;
+    out->code_space = CRED_CODE_SPACE;
+    out->otp_window = OTP_HOTP_LOOKAHEAD + 2 * OTP_TOTP_SKEW + 1;
+    out->otp_space = OTP_MODULUS;
+}
+
+// First boot, a guest PIN set for 10 uses and used 10 times, then both PINs
+// changed together. Deferred saves are flushed where nvs_cache_timer would
+// expire. Leaves the default master PIN replaced.
+void final_bench_nvs_session(final_bench_nvs_t *out) {
+    nvs_erase_key(nvs_handler, "cred_hdr");
+    nvs_erase_key(nvs_handler, "otp_secret");
+    memset(nvs_cache_crc, 0, sizeof(nvs_cache_crc));
+    memset(&nvs_cache_stats, 0, sizeof(nvs_cache_stats));
+    bench_nvs_reset();
+
+    load_passwords();
+    cred_put(CRED_ID_GUEST, "5678", CRED_ROLE_GUEST, 10, 0);
+    nvs_cache_flush();
+    for (int i = 0; i < 10; i++) {
+        cred_consume(CRED_ID_GUEST);
+    }
+    cred_put(CRED_ID_MASTER, "2468", CRED_ROLE_MASTER, CRED_USES_UNLIMITED, 0);
+    cred_put(CRED_ID_GUEST, "1357", CRED_ROLE_GUEST, 1, 0);
+    nvs_cache_flush();
+
+    out->saved = nvs_cache_stats.marks;
+    out->save_points = nvs_cache_stats.saves;
+    out->written = nvs_cache_stats.writes;
+    out->skipped = nvs_cache_stats.skipped;
+    out->commits = bench_nvs.commits;
+    out->bytes = bench_nvs.bytes;
+}
+
+// Sets the RFC 4226 test secret with fresh counters
+void final_bench_otp_reset(void) {
+    otp_set_secret((const uint8_t *)"12345678901234567890");
+}
+
+// Wall-clock time of one otp_verify, which redeems input if it matches
+double final_bench_otp_verify_us(const char *input, bool *ok) {
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *ok = otp_verify(input);
+    return elapsed_us(&start);
+}
+
+int final_bench_otp_window(void) {
+    return OTP_HOTP_LOOKAHEAD + 2 * OTP_TOTP_SKEW + 1;
+}
@@ -0,0 +1,17 @@
+// Final.c again, with a credential table past the device's CRED_TABLE_MAX,
+// for the 10k-entry row of the index bench only. Its tasks never run.
+#define app_main large_app_main
+#define app_task large_app_task
+#define keypad_task large_keypad_task
+#define lcd_render_task large_lcd_render_task
+#define lat_console_task large_lat_console_task
+#define row_pins large_row_pins
+#define col_pins large_col_pins
+#define CRED_TABLE_MAX 16384
+#include "../Final.c"
+
+#include "bench_cred_table.h"
+
+void final_bench_cred_table_large(uint32_t n, final_bench_cred_t *out) {
+    bench_cred_table(n, out);
+}
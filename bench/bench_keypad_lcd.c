@@ -0,0 +1,71 @@
+// keypad-LCD.c built against the fake backend.
+#define app_main klcd_app_main
+#define keypad_init klcd_keypad_init
+#define keypad_scan klcd_keypad_scan
+#define keypad_debounce klcd_keypad_debounce
+#define keypad_task klcd_keypad_task
+#define handle_keypress klcd_handle_keypress
+#define keypad_handler_task klcd_keypad_handler_task
+#define row_pins klcd_row_pins
+#define col_pins klcd_col_pins
+#include "../keypad-LCD.c"
+
+#include "bench.h"
+
+void klcd_bench_init(void) {
+    i2c_master_init();
+    lcd_init();
+    klcd_keypad_init();
+    keypad_queue = xQueueCreate(10, sizeof(keypad_event_t));
+
+    // keypad_handler_task's start-up, without its receive loop
+    memset(lcd_buffer, ' ', sizeof(lcd_buffer));
+    for (int i = 0; i < LCD_ROWS; i++) {
+        lcd_buffer[i][LCD_COLUMNS] = '\0';
+    }
+    strncpy(lcd_buffer[0], "Press keys:", LCD_COLUMNS);
+    cursor_pos = 0;
+    current_row = 0;
+    update_lcd();
+}
+
+void klcd_bench_send_cmd(uint8_t cmd) {
+    lcd_send_cmd(cmd);
+}
+
+void klcd_bench_send_data(uint8_t data) {
+    lcd_send_data(data);
+}
+
+void klcd_bench_print_str(const char *str) {
+    lcd_print_str(str);
+}
+
+void klcd_bench_update_lcd(void) {
+    update_lcd();
+}
+
+void klcd_bench_key(char key) {
+    klcd_handle_keypress(key);
+}
+
+void klcd_bench_hold_key(int row, int col, bool down) {
+    bench_set_key(klcd_row_pins[row], klcd_col_pins[col], down);
+}
+
+// One iteration of keypad_task, rotated so a key changed just before the
+// call sees the full scan interval first (worst case latency)
+void klcd_bench_scan_tick(void) {
+    vTaskDelay(pdMS_TO_TICKS(SCAN_INTERVAL_MS));
+    klcd_keypad_debounce(klcd_keypad_scan());
+}
+
+bool klcd_bench_event(char *key, bool *pressed) {
+    keypad_event_t event;
+    if (xQueueReceive(keypad_queue, &event, 0) != pdTRUE) {
+        return false;
+    }
+    *key = event.key;
+    *pressed = event.is_pressed;
+    return true;
+}
@@ -0,0 +1,647 @@
+// Fake ESP-IDF backend for the host LCD benchmark.
+//
+// I2C writes to the PCF8574 are recorded per transaction and decoded through
+// a small HD44780 model (4-bit mode, DDRAM/CGRAM, display shift) so the
+// benchmark can show what the panel would display. Bus time is modelled from
+// master.clk_speed: 9 SCL periods per byte plus one each for START and STOP.
+// bench_set_bus_stuck() makes every transaction time out, as with SDA held low.
+//
+// GPIO levels are kept per pin, and a keypad matrix model pulls a row input
+// low while a held key connects it to a column driven low.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "idf_fake/fake_idf.h"
+
+#define FAKE_LCD_ADDR 0x27
+#define FAKE_CMD_MAX 512
+#define PCF_RS 0x01
+#define PCF_EN 0x04
+
+bench_counters_t bench_counters;
+
+static uint32_t i2c_clk_hz = 100000;
+static uint64_t now_us;
+static void (*idle_hook)(void);
+static int idle_depth;
+static bool bus_stuck;
+static uint8_t gpio_out[40];         // Driven output levels
+static struct {
+    int row;
+    int col;
+} keys_down[4];                      // Held keys as (row GPIO, column GPIO)
+
+// Command link being built by the firmware
+typedef struct {
+    uint8_t bytes[FAKE_CMD_MAX];
+    size_t len;
+} fake_cmd_t;
+
+// HD44780 model
+static struct {
+    uint8_t ddram[2][40];
+    uint8_t cgram[64];
+    uint8_t addr;
+    bool cgram_mode;
+    int shift;
+    uint8_t last;        // Previous PCF8574 output, for EN falling edges
+    bool have_high;
+    uint8_t high;
+} lcd;
+
+void bench_counters_reset(void) {
+    memset(&bench_counters, 0, sizeof(bench_counters));
+}
+
+void bench_set_idle_hook(void (*hook)(void)) {
+    idle_hook = hook;
+}
+
+void bench_set_bus_stuck(bool stuck) {
+    bus_stuck = stuck;
+}
+
+uint64_t bench_now_us(void) {
+    return now_us;
+}
+
+void bench_set_key(int row_gpio, int col_gpio, bool down) {
+    for (size_t i = 0; i < sizeof(keys_down) / sizeof(keys_down[0]); i++) {
+        if (down && keys_down[i].row == 0) {
+            keys_down[i].row = row_gpio;
+            keys_down[i].col = col_gpio;
+            return;
+        }
+        if (!down && keys_down[i].row == row_gpio && keys_down[i].col == col_gpio) {
+            keys_down[i].row = 0;
+            return;
+        }
+    }
+}
+
+void bench_visible_screen(char out[2][17]) {
+    for (int row = 0; row < 2; row++) {
+        for (int col = 0; col < 16; col++) {
+            uint8_t c = lcd.ddram[row][((col + lcd.shift) % 40 + 40) % 40];
+            out[row][col] = (c < 8) ? '~' : (c < 0x20 || c > 0x7E) ? '?' : (char)c;
+        }
+        out[row][16] = '\0';
+    }
+}
+
+// Instructions decode on their highest set bit
+static void hd44780_command(uint8_t cmd) {
+    if (cmd & 0x80) {
+        lcd.cgram_mode = false;
+        lcd.addr = cmd & 0x7F;
+    } else if (cmd & 0x40) {
+        lcd.cgram_mode = true;
+        lcd.addr = cmd & 0x3F;
+    } else if (cmd & 0x20) {
+        // Function set
+    } else if (cmd & 0x10) {
+        if (cmd & 0x08) {
+            lcd.shift += (cmd & 0x04) ? -1 : 1;
+        }
+    } else if (cmd & 0x0C) {
+        // Display control / entry mode
+    } else if (cmd & 0x03) {
+        if (cmd == 0x01) {
+            memset(lcd.ddram, ' ', sizeof(lcd.ddram));
+        }
+        lcd.addr = 0;
+        lcd.cgram_mode = false;
+        lcd.shift = 0;
+    }
+}
+
+static void hd44780_data(uint8_t data) {
+    if (lcd.cgram_mode) {
+        lcd.cgram[lcd.addr & 0x3F] = data;
+        lcd.addr = (lcd.addr + 1) & 0x3F;
+        return;
+    }
+    int row = (lcd.addr >= 0x40) ? 1 : 0;
+    int col = lcd.addr - (row ? 0x40 : 0);
+    if (col < 40) {
+        lcd.ddram[row][col] = data;
+    }
+    lcd.addr++;
+}
+
+static void pcf8574_write(uint8_t out) {
+    if ((lcd.last & PCF_EN) && !(out & PCF_EN)) {
+        uint8_t nibble = lcd.last >> 4;
+        if (!lcd.have_high) {
+            lcd.high = nibble;
+            lcd.have_high = true;
+        } else {
+            uint8_t value = (lcd.high << 4) | nibble;
+            lcd.have_high = false;
+            if (lcd.last & PCF_RS) {
+                hd44780_data(value);
+            } else {
+                hd44780_command(value);
+            }
+        }
+    }
+    lcd.last = out;
+}
+
+void fake_log(const char *tag, const char *fmt, ...) {
+    (void)tag; (void)fmt;
+}
+
+const char *esp_err_to_name(esp_err_t err) {
+    return (err == ESP_ERR_TIMEOUT) ? "ESP_ERR_TIMEOUT" : "ESP_FAIL";
+}
+
+void esp_rom_delay_us(uint32_t us) {
+    now_us += us;
+}
+
+int64_t esp_timer_get_time(void) {
+    return (int64_t)now_us;
+}
+
+// FreeRTOS
+void vTaskDelay(TickType_t ticks) {
+    bench_counters.delay_us += (uint64_t)ticks * 1000;
+    // The hook stands in for tasks that would run while the caller sleeps,
+    // so time advances one tick at a time
+    for (TickType_t i = 0; i < ticks; i++) {
+        now_us += 1000;
+        if (idle_hook && idle_depth == 0) {
+            idle_depth++;
+            idle_hook();
+            idle_depth--;
+        }
+    }
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(now_us / 1000);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                       UBaseType_t prio, TaskHandle_t *handle) {
+    (void)fn; (void)name; (void)stack; (void)arg; (void)prio; (void)handle;
+    return pdPASS;
+}
+
+// Tasks never run on the host, so notifications are accepted and dropped
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    (void)task;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    (void)task;
+    *woken = pdFALSE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+    (void)clear; (void)wait;
+    return 0;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    (void)task; (void)value; (void)action;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t wait) {
+    (void)clear_on_entry; (void)clear_on_exit; (void)wait;
+    *value = 0;
+    return pdFALSE;
+}
+
+// Software timers keep their expiry but never fire their callback
+typedef struct {
+    TickType_t period;
+    TickType_t expiry;
+    bool active;
+} fake_timer_t;
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *id,
+                           TimerCallbackFunction_t callback) {
+    fake_timer_t *t = calloc(1, sizeof(*t));
+    (void)name; (void)auto_reload; (void)id; (void)callback;
+    t->period = period;
+    return t;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait) {
+    fake_timer_t *t = timer;
+    (void)wait;
+    t->period = period;
+    t->expiry = xTaskGetTickCount() + period;
+    t->active = true;
+    return pdPASS;
+}
+
+BaseType_t xTimerResetFromISR(TimerHandle_t timer, BaseType_t *woken) {
+    fake_timer_t *t = timer;
+    (void)woken;
+    return xTimerChangePeriod(timer, t->period, 0);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait) {
+    (void)wait;
+    ((fake_timer_t *)timer)->active = false;
+    return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer) {
+    fake_timer_t *t = timer;
+    if (t->active && (int32_t)(xTaskGetTickCount() - t->expiry) >= 0) {
+        t->active = false;
+    }
+    return t->active;
+}
+
+TickType_t xTimerGetExpiryTime(TimerHandle_t timer) {
+    return ((fake_timer_t *)timer)->expiry;
+}
+
+static int fake_mutex;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return &fake_mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    return pdTRUE;
+}
+
+typedef struct {
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *items;
+} fake_queue_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    fake_queue_t *q = calloc(1, sizeof(*q));
+    q->length = length;
+    q->item_size = item_size;
+    q->items = calloc(length, item_size);
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+    fake_queue_t *q = queue;
+    (void)wait;
+    if (q->count == q->length) {
+        return pdFALSE;
+    }
+    memcpy(q->items + ((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+    q->count++;
+    return pdTRUE;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item) {
+    fake_queue_t *q = queue;
+    memcpy(q->items, item, q->item_size);
+    q->head = 0;
+    q->count = 1;
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+    fake_queue_t *q = queue;
+    (void)wait;
+    if (q->count == 0) {
+        return pdFALSE;
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    return pdTRUE;
+}
+
+// GPIO
+esp_err_t gpio_reset_pin(gpio_num_t pin) { (void)pin; return ESP_OK; }
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode) { (void)pin; (void)mode; return ESP_OK; }
+esp_err_t gpio_set_pull_mode(gpio_num_t pin, gpio_pull_mode_t pull) { (void)pin; (void)pull; return ESP_OK; }
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level) {
+    gpio_out[pin] = level ? 1 : 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin) {
+    for (size_t i = 0; i < sizeof(keys_down) / sizeof(keys_down[0]); i++) {
+        if (keys_down[i].row == (int)pin && gpio_out[keys_down[i].col] == 0) {
+            return 0;
+        }
+    }
+    return 1;  // Pulled up
+}
+
+uint32_t fake_reg_read(uint32_t addr) {
+    uint32_t in = 0;
+    if (addr == GPIO_IN_REG) {
+        for (int pin = 0; pin < 32; pin++) {
+            in |= (uint32_t)gpio_get_level((gpio_num_t)pin) << pin;
+        }
+    }
+    return in;
+}
+esp_err_t gpio_install_isr_service(int flags) { (void)flags; return ESP_OK; }
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type) { (void)pin; (void)type; return ESP_OK; }
+esp_err_t gpio_intr_enable(gpio_num_t pin) { (void)pin; return ESP_OK; }
+esp_err_t gpio_intr_disable(gpio_num_t pin) { (void)pin; return ESP_OK; }
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void *arg) {
+    (void)pin; (void)handler; (void)arg;
+    return ESP_OK;
+}
+
+// esp_timer timers and LEDC are accepted but inert
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer) {
+    (void)args;
+    *timer = calloc(1, 1);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    (void)timer; (void)timeout_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    (void)timer;
+    return ESP_OK;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *conf) { (void)conf; return ESP_OK; }
+esp_err_t ledc_channel_config(const ledc_channel_config_t *conf) { (void)conf; return ESP_OK; }
+esp_err_t ledc_fade_func_install(int flags) { (void)flags; return ESP_OK; }
+esp_err_t ledc_set_fade_with_time(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty, int ms) {
+    (void)mode; (void)channel; (void)duty; (void)ms;
+    return ESP_OK;
+}
+esp_err_t ledc_fade_start(ledc_mode_t mode, ledc_channel_t channel, ledc_fade_mode_t wait) {
+    (void)mode; (void)channel; (void)wait;
+    return ESP_OK;
+}
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty) {
+    (void)mode; (void)channel; (void)duty;
+    return ESP_OK;
+}
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel) { (void)mode; (void)channel; return ESP_OK; }
+
+// UART, no console input on the host
+esp_err_t uart_driver_install(uart_port_t port, int rx_size, int tx_size, int queue_size,
+                              QueueHandle_t *queue, int flags) {
+    (void)port; (void)rx_size; (void)tx_size; (void)queue_size; (void)queue; (void)flags;
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t len, TickType_t wait) {
+    (void)port; (void)buf; (void)len; (void)wait;
+    return 0;
+}
+
+int uart_write_bytes(uart_port_t port, const void *src, size_t size) {
+    (void)port; (void)src;
+    return size;
+}
+
+// I2C
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *conf) {
+    (void)port;
+    i2c_clk_hz = conf->master.clk_speed;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t mode, size_t rx, size_t tx, int flags) {
+    (void)port; (void)mode; (void)rx; (void)tx; (void)flags;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t port) {
+    (void)port;
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void) {
+    return calloc(1, sizeof(fake_cmd_t));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd) {
+    free(cmd);
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd) { (void)cmd; return ESP_OK; }
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd) { (void)cmd; return ESP_OK; }
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, bool ack) {
+    return i2c_master_write(cmd, &data, 1, ack);
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd, const uint8_t *data, size_t len, bool ack) {
+    fake_cmd_t *c = cmd;
+    (void)ack;
+    if (c->len + len > FAKE_CMD_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(c->bytes + c->len, data, len);
+    c->len += len;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t wait) {
+    fake_cmd_t *c = cmd;
+    (void)port;
+    if (c->len == 0 || c->bytes[0] != (FAKE_LCD_ADDR << 1)) {
+        return ESP_FAIL;
+    }
+    if (bus_stuck) {
+        bench_counters.transactions++;
+        bench_counters.bus_us += (uint64_t)wait * 1000;
+        now_us += (uint64_t)wait * 1000;
+        return ESP_ERR_TIMEOUT;
+    }
+    for (size_t i = 1; i < c->len; i++) {
+        pcf8574_write(c->bytes[i]);
+    }
+
+    uint64_t bits = (uint64_t)c->len * 9 + 2;
+    uint64_t us = (bits * 1000000 + i2c_clk_hz - 1) / i2c_clk_hz;
+    bench_counters.transactions++;
+    bench_counters.bytes += c->len;
+    bench_counters.bus_us += us;
+    now_us += us;
+    return ESP_OK;
+}
+
+// NVS, empty on every run. Blobs are kept in memory so state written during
+// a bench can be read back as after a reboot.
+#define BENCH_NVS_KEYS 64
+
+static struct {
+    char key[16];
+    void *value;
+    size_t len;
+} nvs_blobs[BENCH_NVS_KEYS];
+
+static int nvs_blob_slot(const char *key) {
+    for (int i = 0; i < BENCH_NVS_KEYS; i++) {
+        if (nvs_blobs[i].value && strcmp(nvs_blobs[i].key, key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_flash_erase(void) { return ESP_OK; }
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *handle) {
+    (void)ns; (void)mode;
+    *handle = 1;
+    return ESP_OK;
+}
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out, size_t *len) {
+    int i = nvs_blob_slot(key);
+
+    (void)handle;
+    if (i < 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out != NULL && *len < nvs_blobs[i].len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if (out != NULL) {
+        memcpy(out, nvs_blobs[i].value, nvs_blobs[i].len);
+    }
+    *len = nvs_blobs[i].len;
+    return ESP_OK;
+}
+bench_nvs_t bench_nvs;
+
+void bench_nvs_reset(void) {
+    memset(&bench_nvs, 0, sizeof(bench_nvs));
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t len) {
+    int i = nvs_blob_slot(key);
+
+    (void)handle;
+    if (i < 0) {
+        for (i = 0; i < BENCH_NVS_KEYS && nvs_blobs[i].value; i++) {
+        }
+        if (i == BENCH_NVS_KEYS) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        snprintf(nvs_blobs[i].key, sizeof(nvs_blobs[i].key), "%s", key);
+    }
+    free(nvs_blobs[i].value);
+    nvs_blobs[i].value = malloc(len ? len : 1);
+    memcpy(nvs_blobs[i].value, value, len);
+    nvs_blobs[i].len = len;
+    bench_nvs.sets++;
+    bench_nvs.bytes += len;
+    return ESP_OK;
+}
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out) {
+    (void)handle; (void)key; (void)out;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value) {
+    (void)handle; (void)key; (void)value;
+    bench_nvs.sets++;
+    bench_nvs.bytes += sizeof(value);
+    return ESP_OK;
+}
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out) {
+    (void)handle; (void)key; (void)out;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+    (void)handle; (void)key; (void)value;
+    bench_nvs.sets++;
+    bench_nvs.bytes += sizeof(value);
+    return ESP_OK;
+}
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    int i = nvs_blob_slot(key);
+
+    (void)handle;
+    if (i < 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    free(nvs_blobs[i].value);
+    nvs_blobs[i].value = NULL;
+    return ESP_OK;
+}
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    (void)handle;
+    bench_nvs.commits++;
+    return ESP_OK;
+}
+
+// Never restarts, so shutdown handlers are not kept
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+
+// Flash partition: a single erased 4 KiB sector where writes can only clear bits
+static uint8_t flash_sector[4096];
+static bool flash_erased;
+static const esp_partition_t flash_part = {ESP_PARTITION_TYPE_DATA, 0x40, 0x3F0000, sizeof(flash_sector), "consumed"};
+bench_flash_t bench_flash;
+
+void bench_flash_reset(void) {
+    memset(&bench_flash, 0, sizeof(bench_flash));
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    if (type != flash_part.type || subtype != flash_part.subtype || strcmp(label, flash_part.label) != 0) {
+        return NULL;
+    }
+    if (!flash_erased) {
+        memset(flash_sector, 0xFF, sizeof(flash_sector));
+        flash_erased = true;
+    }
+    return &flash_part;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, flash_sector + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    const uint8_t *bytes = src;
+
+    if (dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        flash_sector[dst_offset + i] &= bytes[i];
+    }
+    bench_flash.writes++;
+    bench_flash.bytes += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(flash_sector + offset, 0xFF, size);
+    bench_flash.erases++;
+    return ESP_OK;
+}
@@ -0,0 +1,306 @@
+// Software PBKDF2-HMAC-SHA256, HMAC-SHA1, CRC32 and a seeded RNG standing in
+// for mbedtls, the ROM CRC and esp_random, so credential timings on the host come from real hashing.
+#include <string.h>
+
+#include "fake_idf.h"
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t bytes;
+    uint8_t block[64];
+    size_t used;
+} sha256_t;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(sha256_t *ctx, const uint8_t *p) {
+    uint32_t w[64], v[8], t1, t2;
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    memcpy(v, ctx->state, sizeof(v));
+    for (int i = 0; i < 64; i++) {
+        t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[i] + w[i];
+        t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++) {
+        ctx->state[i] += v[i];
+    }
+}
+
+static void sha256_init(sha256_t *ctx) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->bytes = 0;
+    ctx->used = 0;
+}
+
+static void sha256_update(sha256_t *ctx, const uint8_t *p, size_t len) {
+    ctx->bytes += len;
+    while (len--) {
+        ctx->block[ctx->used++] = *p++;
+        if (ctx->used == 64) {
+            sha256_block(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha256_finish(sha256_t *ctx, uint8_t *out) {
+    uint64_t bits = ctx->bytes * 8;
+    uint8_t pad = 0x80;
+
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        sha256_update(ctx, &pad, 1);
+    }
+    for (int i = 7; i >= 0; i--) {
+        uint8_t b = bits >> (8 * i);
+        sha256_update(ctx, &b, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = ctx->state[i] >> 24;
+        out[4 * i + 1] = ctx->state[i] >> 16;
+        out[4 * i + 2] = ctx->state[i] >> 8;
+        out[4 * i + 3] = ctx->state[i];
+    }
+}
+
+// HMAC with the key already padded into ipad/opad blocks
+static void hmac_sha256(const uint8_t *ipad, const uint8_t *opad, const uint8_t *msg, size_t len, uint8_t *out) {
+    sha256_t ctx;
+    uint8_t inner[32];
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, ipad, 64);
+    sha256_update(&ctx, msg, len);
+    sha256_finish(&ctx, inner);
+    sha256_init(&ctx);
+    sha256_update(&ctx, opad, 64);
+    sha256_update(&ctx, inner, sizeof(inner));
+    sha256_finish(&ctx, out);
+}
+
+int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t md_type, const unsigned char *password, size_t plen,
+                                  const unsigned char *salt, size_t slen, unsigned int iteration_count,
+                                  uint32_t key_length, unsigned char *output) {
+    uint8_t ipad[64] = {0}, opad[64], msg[64 + 4], u[32], t[32];
+
+    if (md_type != MBEDTLS_MD_SHA256 || plen > 64 || slen > 64) {
+        return -1;
+    }
+    memcpy(ipad, password, plen);
+    for (int i = 0; i < 64; i++) {
+        opad[i] = ipad[i] ^ 0x5c;
+        ipad[i] ^= 0x36;
+    }
+
+    for (uint32_t block = 1; key_length > 0; block++) {
+        uint32_t n = key_length < 32 ? key_length : 32;
+
+        memcpy(msg, salt, slen);
+        msg[slen] = block >> 24;
+        msg[slen + 1] = block >> 16;
+        msg[slen + 2] = block >> 8;
+        msg[slen + 3] = block;
+        hmac_sha256(ipad, opad, msg, slen + 4, u);
+        memcpy(t, u, sizeof(t));
+        for (unsigned int i = 1; i < iteration_count; i++) {
+            hmac_sha256(ipad, opad, u, sizeof(u), u);
+            for (int j = 0; j < 32; j++) {
+                t[j] ^= u[j];
+            }
+        }
+        memcpy(output, t, n);
+        output += n;
+        key_length -= n;
+    }
+    return 0;
+}
+
+// SHA-1 for the HMAC-SHA1 used by the OTP codes
+typedef struct {
+    uint32_t state[5];
+    uint64_t bytes;
+    uint8_t block[64];
+    size_t used;
+} sha1_t;
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(sha1_t *ctx, const uint8_t *p) {
+    uint32_t w[80], a, b, c, d, e, f, k, t;
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3]; e = ctx->state[4];
+    for (int i = 0; i < 80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d); k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d; k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d; k = 0xca62c1d6;
+        }
+        t = ROL(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = ROL(b, 30); b = a; a = t;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d; ctx->state[4] += e;
+}
+
+static void sha1_init(sha1_t *ctx) {
+    static const uint32_t iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->bytes = 0;
+    ctx->used = 0;
+}
+
+static void sha1_update(sha1_t *ctx, const uint8_t *p, size_t len) {
+    ctx->bytes += len;
+    while (len--) {
+        ctx->block[ctx->used++] = *p++;
+        if (ctx->used == 64) {
+            sha1_block(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha1_finish(sha1_t *ctx, uint8_t *out) {
+    uint64_t bits = ctx->bytes * 8;
+    uint8_t pad = 0x80;
+
+    sha1_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        sha1_update(ctx, &pad, 1);
+    }
+    for (int i = 7; i >= 0; i--) {
+        uint8_t b = bits >> (8 * i);
+        sha1_update(ctx, &b, 1);
+    }
+    for (int i = 0; i < 5; i++) {
+        out[4 * i] = ctx->state[i] >> 24;
+        out[4 * i + 1] = ctx->state[i] >> 16;
+        out[4 * i + 2] = ctx->state[i] >> 8;
+        out[4 * i + 3] = ctx->state[i];
+    }
+}
+
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t md_type) {
+    static int sha1_info;
+    return (md_type == MBEDTLS_MD_SHA1) ? (const mbedtls_md_info_t *)&sha1_info : NULL;
+}
+
+void mbedtls_md_init(mbedtls_md_context_t *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_md_free(mbedtls_md_context_t *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_md_setup(mbedtls_md_context_t *ctx, const mbedtls_md_info_t *md_info, int hmac) {
+    (void)ctx;
+    return (md_info && hmac) ? 0 : -1;
+}
+
+int mbedtls_md_hmac_starts(mbedtls_md_context_t *ctx, const unsigned char *key, size_t keylen) {
+    if (keylen > 64) {
+        return -1;
+    }
+    memset(ctx->ipad, 0, sizeof(ctx->ipad));
+    memcpy(ctx->ipad, key, keylen);
+    for (int i = 0; i < 64; i++) {
+        ctx->opad[i] = ctx->ipad[i] ^ 0x5c;
+        ctx->ipad[i] ^= 0x36;
+    }
+    ctx->len = 0;
+    return 0;
+}
+
+int mbedtls_md_hmac_update(mbedtls_md_context_t *ctx, const unsigned char *input, size_t ilen) {
+    if (ctx->len + ilen > sizeof(ctx->msg)) {
+        return -1;
+    }
+    memcpy(ctx->msg + ctx->len, input, ilen);
+    ctx->len += ilen;
+    return 0;
+}
+
+int mbedtls_md_hmac_finish(mbedtls_md_context_t *ctx, unsigned char *output) {
+    sha1_t sha;
+    uint8_t inner[20];
+
+    sha1_init(&sha);
+    sha1_update(&sha, ctx->ipad, 64);
+    sha1_update(&sha, ctx->msg, ctx->len);
+    sha1_finish(&sha, inner);
+    sha1_init(&sha);
+    sha1_update(&sha, ctx->opad, 64);
+    sha1_update(&sha, inner, sizeof(inner));
+    sha1_finish(&sha, output);
+    return 0;
+}
+
+int mbedtls_md_hmac_reset(mbedtls_md_context_t *ctx) {
+    ctx->len = 0;
+    return 0;
+}
+
+static uint32_t rng_seed = 0x12345678;
+
+void esp_fill_random(void *buf, size_t len) {
+    uint8_t *p = buf;
+
+    while (len--) {
+        rng_seed = rng_seed * 1103515245 + 12345;
+        *p++ = rng_seed >> 16;
+    }
+}
+
+uint32_t esp_random(void) {
+    uint32_t r;
+    esp_fill_random(&r, sizeof(r));
+    return r;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
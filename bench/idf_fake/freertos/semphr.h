@@ -0,0 +1 @@
+#include "../fake_idf.h"
@@ -0,0 +1,352 @@
+// Host LCD transport benchmark.
+//
+// Compiles the display code of Final.c and keypad-LCD.c unchanged against a
+// fake I2C bus (fake_bus.c) and reports, per screen, the I2C transactions,
+// bytes and modelled time at the firmware's master.clk_speed. Run it before
+// and after a display change to compare. Exits with 1 if a security check
+// (break-in chance under the limiter, RFC 4226 codes, OTP replay) fails.
+//
+//   gcc -std=gnu11 -O2 -Ibench/idf_fake -o lcd_bench bench/*.c && ./lcd_bench
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+static bool bench_failed;  // A check printed FAILED, EXCEEDED or ACCEPTED
+static int bench_batch_codes;  // Courier codes live after bench_final_provision
+
+static void print_header(const char *title) {
+    printf("\n%s\n", title);
+    printf("%-28s %6s %6s %9s %9s  %s\n", "", "txns", "bytes", "bus ms", "sleep ms", "panel");
+}
+
+static void print_row(const char *label) {
+    char screen[2][17];
+    bench_visible_screen(screen);
+    printf("%-28s %6u %6u %9.2f %9.2f  |%s|%s|\n", label,
+           (unsigned)bench_counters.transactions, (unsigned)bench_counters.bytes,
+           bench_counters.bus_us / 1000.0, bench_counters.delay_us / 1000.0,
+           screen[0], screen[1]);
+}
+
+static void bench_final_states(void) {
+    print_header("Final.c display_menu, entered from MAIN_MENU");
+    for (int state = 0; state < FINAL_BENCH_STATES; state++) {
+        final_bench_show(0, 0);
+        bench_counters_reset();
+        final_bench_show(state, 0);
+        print_row(final_bench_state_name(state));
+
+        // Masked PIN entry screens: cost of one more digit
+        if (final_bench_is_pin_entry(state)) {
+            final_bench_show(state, 3);
+            bench_counters_reset();
+            final_bench_show(state, 4);
+            print_row("  +1 digit");
+        }
+    }
+}
+
+static void bench_final_session(void) {
+    // Wrong PIN, master unlock, early relock, then a guest PIN change
+    static const char session[] = "19999#11234#C2B1234#5678#C";
+    bench_counters_t total = {0};
+    char label[32];
+
+    print_header("Final.c unlock session replay, per key");
+    final_bench_show(0, 0);
+    for (size_t i = 0; i < strlen(session); i++) {
+        bench_counters_reset();
+        final_bench_key(session[i]);
+        snprintf(label, sizeof(label), "key '%c'", session[i]);
+        print_row(label);
+
+        total.transactions += bench_counters.transactions;
+        total.bytes += bench_counters.bytes;
+        total.bus_us += bench_counters.bus_us;
+        total.delay_us += bench_counters.delay_us;
+    }
+    bench_counters = total;
+    print_row("session total");
+}
+
+static void print_bus_health(const char *label) {
+    uint32_t errors, trips, recoveries;
+    bool down;
+
+    final_bench_bus_health(&errors, &trips, &recoveries, &down);
+    print_row(label);
+    printf("%-28s errors=%u trips=%u recoveries=%u %s\n", "",
+           (unsigned)errors, (unsigned)trips, (unsigned)recoveries, down ? "DOWN" : "OK");
+}
+
+static void bench_final_bus_fault(void) {
+    print_header("Final.c with the panel bus stuck, then released");
+    final_bench_show(0, 0);
+
+    bench_set_bus_stuck(true);
+    bench_counters_reset();
+    final_bench_key('1');
+    final_bench_key('1');
+    final_bench_key('2');
+    print_bus_health("3 keys, bus stuck");
+
+    bench_counters_reset();
+    final_bench_idle(5000);
+    print_bus_health("5 s idle, bus stuck");
+
+    bench_set_bus_stuck(false);
+    bench_counters_reset();
+    final_bench_idle(30000);
+    print_bus_health("30 s idle, bus released");
+}
+
+// Median of a few lookups, to keep scheduler noise out of the comparison
+static double verify_ms(const char *guess) {
+    double runs[5], t;
+    bool ok;
+
+    for (int i = 0; i < 5; i++) {
+        runs[i] = final_bench_verify_us(guess, &ok);
+        for (int j = i; j > 0 && runs[j] < runs[j - 1]; j--) {
+            t = runs[j]; runs[j] = runs[j - 1]; runs[j - 1] = t;
+        }
+    }
+    return runs[2] / 1000.0;
+}
+
+static void bench_final_credentials(void) {
+    uint32_t sizes[] = {10, 1000, final_bench_cred_capacity(), 10000};
+    uint32_t iterations = final_bench_kdf_iterations();
+    uint32_t budget_ms = final_bench_verify_budget_ms();
+    double ms = verify_ms("1234");
+    final_bench_cred_t t;
+    char label[40];
+
+    // Host software SHA only; the on-device figure comes from the console 'k' command
+    printf("\nFinal.c credential verify, PBKDF2-HMAC-SHA256 (host, software SHA)\n");
+    printf("%-28s %9.0f\n", "iterations/s", iterations / ms * 1000.0);
+    printf("%-28s %9.0f\n", "iterations in budget", budget_ms / ms * iterations);
+    snprintf(label, sizeof(label), "%u iterations, correct", (unsigned)iterations);
+    printf("%-28s %9.3f ms\n", label, ms);
+    printf("%-28s %9.3f ms\n", "  wrong first digit", verify_ms("9234"));
+    printf("%-28s %9.3f ms\n", "  wrong last digit", verify_ms("1239"));
+    printf("%-28s %9.3f ms\n", "  wrong length", verify_ms("12345"));
+
+    // Rows past the device table come from the build in bench_final_large.c;
+    // DRAM is what that build's table, batch and index take however full
+    printf("\nFinal.c credential table index, KDF excluded\n");
+    printf("%-10s %10s %10s %10s %8s %11s %9s %10s %9s\n", "entries", "insert ns", "hit ns", "miss ns",
+           "probes", "rebuild us", "RAM KiB", "table max", "DRAM KiB");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (sizes[i] <= final_bench_cred_capacity()) {
+            final_bench_cred_table(sizes[i], &t);
+        } else {
+            final_bench_cred_table_large(sizes[i], &t);
+        }
+        printf("%-10u %10.1f %10.1f %10.1f %8.2f %11.1f %9.1f %10u %9.1f\n", (unsigned)sizes[i], t.insert_ns,
+               t.hit_ns, t.miss_ns, t.probes, t.rebuild_us, t.ram_bytes / 1024.0, (unsigned)t.table_max,
+               t.dram_bytes / 1024.0);
+    }
+}
+
+static void bench_final_provision(void) {
+    int stored;
+    double apply_ms;
+    double stage_ms = final_bench_provision_ms(1000, &stored, &apply_ms);
+
+    bench_batch_codes = stored;
+    printf("\nFinal.c courier batch, 1000 generated codes (host, software SHA)\n");
+    printf("%-28s %9.1f ms\n", "generate + KDF", stage_ms);
+    printf("%-28s %9.3f ms\n", "apply to index", apply_ms);
+    printf("%-28s %9u stored\n", "", (unsigned)stored);
+    printf("%-28s %9u blob(s) %u bytes %u commit(s)\n", "NVS", (unsigned)bench_nvs.sets,
+           (unsigned)bench_nvs.bytes, (unsigned)bench_nvs.commits);
+}
+
+// Redeeming the whole batch, then a year of weekly batches
+static void bench_final_consumed(void) {
+    int marked, spent;
+
+    bench_nvs_reset();
+    bench_flash_reset();
+    final_bench_consumed_mark_all(&marked, &spent);
+    printf("\nFinal.c consumed-code bitmap, %d courier codes redeemed\n", marked);
+    printf("%-28s %9d\n", "read back as spent", spent);
+    printf("%-28s %9u write(s) %u bytes %u erase(s)\n", "flash", (unsigned)bench_flash.writes,
+           (unsigned)bench_flash.bytes, (unsigned)bench_flash.erases);
+    printf("%-28s %9u blob(s) %u bytes\n", "NVS", (unsigned)bench_nvs.sets, (unsigned)bench_nvs.bytes);
+    printf("%-28s %9d erase(s)\n", "100 further batches", final_bench_consumed_cycle(100));
+    printf("%-28s %9d slot(s) wrong\n", "reopen after power loss", final_bench_consumed_reopen());
+}
+
+// Wrong PINs let through per day by the keypad limiter, and the chance that
+// the worst attack's guesses hit any credential live at the same time: the
+// PINs, the provisioned courier batch and the OTP accept window. A guess
+// is counted against every class at once, which overstates it slightly.
+#define RATE_DAYS 30
+#define RATE_COURIER_MAX_PCT 0.01  // Per day, courier codes and OTP together
+#define RATE_BREAK_MAX_PCT 1.0     // Per day, all live credentials
+
+// Chance in % that at least one of guesses, each hitting with p, succeeds
+static double rate_hit_pct(double p, uint32_t guesses) {
+    double miss = 1.0;
+    for (uint32_t i = 0; i < guesses; i++) {
+        miss *= 1.0 - p;
+    }
+    return 100.0 * (1.0 - miss);
+}
+
+static void bench_final_rate(void) {
+    static const char *const names[FINAL_BENCH_ATTACKS] = {
+        [FINAL_BENCH_ATTACK_GREEDY] = "greedy",
+        [FINAL_BENCH_ATTACK_BURST] = "full bucket",
+        [FINAL_BENCH_ATTACK_TRICKLE] = "trickle",
+        [FINAL_BENCH_ATTACK_HAMMER] = "1 per second",
+        [FINAL_BENCH_ATTACK_POWER] = "power cut each try",
+    };
+    uint32_t per_day[RATE_DAYS], nvs_writes, worst = 0;
+    final_bench_live_t live;
+
+    printf("\nFinal.c keypad attempt limiter, %d wrong PINs then backoff, %d simulated days\n",
+           final_bench_rate_burst(), RATE_DAYS);
+    printf("%-20s %8s %8s %8s %9s\n", "attack", "day 1", "max/day", "total", "NVS/day");
+    for (int a = 0; a < FINAL_BENCH_ATTACKS; a++) {
+        uint32_t total = 0, max_day = 0;
+        final_bench_rate_attack(a, RATE_DAYS, per_day, &nvs_writes);
+        for (int d = 0; d < RATE_DAYS; d++) {
+            total += per_day[d];
+            max_day = per_day[d] > max_day ? per_day[d] : max_day;
+        }
+        worst = max_day > worst ? max_day : worst;
+        printf("%-20s %8u %8u %8u %9.1f\n", names[a], (unsigned)per_day[0], (unsigned)max_day,
+               (unsigned)total, (double)nvs_writes / RATE_DAYS);
+    }
+
+    final_bench_live(&live);
+    double pin = (double)live.pins / live.pin_space;
+    double courier = (double)bench_batch_codes / live.code_space + (double)live.otp_window / live.otp_space;
+    double pin_pct = rate_hit_pct(pin, worst);
+    double courier_pct = rate_hit_pct(courier, worst);
+    double total_pct = rate_hit_pct(pin + courier, worst);
+
+    printf("live: %u PINs of 1 in %u, %d courier codes of 1 in %u, %u OTP codes of 1 in %u; %u guesses/day\n",
+           (unsigned)live.pins, (unsigned)live.pin_space, bench_batch_codes, (unsigned)live.code_space,
+           (unsigned)live.otp_window, (unsigned)live.otp_space, (unsigned)worst);
+    printf("%-20s %9.4f%% per day\n", "hit a PIN", pin_pct);
+    printf("%-20s %9.4f%% per day, limit %.2f%%: %s\n", "hit a courier code", courier_pct, RATE_COURIER_MAX_PCT,
+           courier_pct <= RATE_COURIER_MAX_PCT ? "ok" : "EXCEEDED");
+    printf("%-20s %9.4f%% per day, limit %.2f%%: %s\n", "hit anything", total_pct, RATE_BREAK_MAX_PCT,
+           total_pct <= RATE_BREAK_MAX_PCT ? "ok" : "EXCEEDED");
+    bench_failed |= courier_pct > RATE_COURIER_MAX_PCT || total_pct > RATE_BREAK_MAX_PCT;
+}
+
+// RFC 4226 appendix D codes, 8 digits from its truncated values
+static void bench_final_otp(void) {
+    static const char *const codes[] = {"84755224", "94287082", "37359152", "26969429", "40338314"};
+    double miss_ms = 0, t;
+    bool ok, all = true;
+
+    final_bench_otp_reset();
+    for (int i = 0; i < 100; i++) {
+        miss_ms += final_bench_otp_verify_us("00000000", &ok) / 1000.0 / 100;
+    }
+
+    // Out of order within the look-ahead, then replays
+    for (int i = 4; i >= 0; i--) {
+        t = final_bench_otp_verify_us(codes[i], &ok) / 1000.0;
+        all = all && ok;
+    }
+    printf("\nFinal.c HOTP/TOTP courier codes (host, software SHA-1)\n");
+    printf("%-28s %9.3f ms  (%d HMACs)\n", "miss, full window", miss_ms, final_bench_otp_window());
+    printf("%-28s %9.3f ms\n", "hit", t);
+    printf("%-28s %9s\n", "RFC 4226 counters 4..0", all ? "accepted" : "FAILED");
+    final_bench_otp_verify_us(codes[2], &ok);
+    printf("%-28s %9s\n", "replay of counter 2", ok ? "ACCEPTED" : "rejected");
+    bench_failed |= !all || ok;
+}
+
+// What the NVS write cache saved over a first boot, 10 guest unlocks and a
+// PIN change, against one write per record and one commit per save
+static void bench_final_nvs(void) {
+    final_bench_nvs_t t;
+
+    final_bench_nvs_session(&t);
+    printf("\nFinal.c NVS write cache, first boot + 10 guest unlocks + PIN change\n");
+    printf("%-28s %9u records %u commits\n", "saved by owners", (unsigned)t.saved, (unsigned)t.save_points);
+    printf("%-28s %9u records %u commits %u bytes\n", "written", (unsigned)t.written, (unsigned)t.commits,
+           (unsigned)t.bytes);
+    printf("%-28s %9u\n", "unchanged, skipped", (unsigned)t.skipped);
+    printf("%-28s %9.2fx records %.2fx commits\n", "write amplification cut", (double)t.saved / t.written,
+           (double)t.save_points / t.commits);
+}
+
+// Time from a key changing to its event, scanning as keypad_task does
+static double klcd_event_latency_ms(int row, int col, bool down) {
+    uint64_t start = bench_now_us();
+    char key;
+    bool pressed;
+
+    klcd_bench_hold_key(row, col, down);
+    for (int tick = 0; tick < 1000; tick++) {
+        klcd_bench_scan_tick();
+        if (klcd_bench_event(&key, &pressed)) {
+            return (bench_now_us() - start) / 1000.0;
+        }
+    }
+    return -1.0;
+}
+
+static void bench_keypad_scan(void) {
+    uint64_t start;
+
+    printf("\nkeypad-LCD.c keypad scan\n");
+
+    start = bench_now_us();
+    klcd_bench_scan_tick();
+    printf("%-28s %9.3f ms\n", "scan period, idle", (bench_now_us() - start) / 1000.0);
+    printf("%-28s %9.3f ms\n", "key '5' press, worst case", klcd_event_latency_ms(1, 1, true));
+    printf("%-28s %9.3f ms\n", "key '5' release, worst case", klcd_event_latency_ms(1, 1, false));
+}
+
+static void bench_keypad_lcd(void) {
+    print_header("keypad-LCD.c transport");
+
+    bench_counters_reset();
+    klcd_bench_send_cmd(0x80);
+    print_row("lcd_send_cmd");
+
+    bench_counters_reset();
+    klcd_bench_send_data('A');
+    print_row("lcd_send_data");
+
+    bench_counters_reset();
+    klcd_bench_print_str("0123456789ABCDEF");
+    print_row("lcd_print_str (16 chars)");
+
+    bench_counters_reset();
+    klcd_bench_update_lcd();
+    print_row("update_lcd");
+
+    bench_counters_reset();
+    klcd_bench_key('5');
+    print_row("handle_keypress");
+}
+
+int main(void) {
+    final_bench_init();
+    bench_final_states();
+    bench_final_session();
+    bench_final_bus_fault();
+    bench_final_credentials();
+    bench_final_provision();
+    bench_final_consumed();
+    bench_final_otp();
+    bench_final_rate();
+    bench_final_nvs();
+
+    klcd_bench_init();
+    bench_keypad_lcd();
+    bench_keypad_scan();
+    return bench_failed ? 1 : 0;
+}
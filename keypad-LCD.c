@@ -6,12 +6,18 @@
 #include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc.h"
 
 // Keypad Configuration
 #define ROWS 4
 #define COLS 4
 #define DEBOUNCE_DELAY_MS 20
-#define SCAN_INTERVAL_MS 50
+#define SCAN_INTERVAL_MS 5          // One full matrix scan per interval
+#define DEBOUNCE_SAMPLES (DEBOUNCE_DELAY_MS / SCAN_INTERVAL_MS)  // Equal scans to change a key
+#define DEBOUNCE_MASK ((1u << DEBOUNCE_SAMPLES) - 1)
+#define COLUMN_SETTLE_US 10         // Row pull-ups recovering after a column is released
 
 // Keypad GPIO Pins
 const gpio_num_t row_pins[ROWS] = {GPIO_NUM_13, GPIO_NUM_12, GPIO_NUM_14, GPIO_NUM_27};
@@ -44,29 +50,58 @@ static const char keymap[ROWS][COLS] = {
 #define LCD_BACKLIGHT               0x08
 #define LCD_DATA                    0x01
 #define LCD_COMMAND                 0x00
+#define LCD_ENABLE                  0x04
+#define LCD_BATCH_MAX               40      // HD44780 bytes per I2C transaction
+
+// Batched LCD transport buffer, up to LCD_BATCH_MAX HD44780 bytes per transaction
+typedef struct {
+    uint8_t buf[LCD_BATCH_MAX * 4];
+    size_t len;
+} lcd_batch_t;
+
+// LCD bus counters (totals since boot and for the screen being drawn)
+typedef struct {
+    uint32_t total_bytes;
+    uint32_t total_transactions;
+    uint32_t screen_bytes;
+    uint32_t screen_transactions;
+} lcd_stats_t;
 
 // Global variables
+static lcd_stats_t lcd_stats;
 static QueueHandle_t keypad_queue;
 static char lcd_buffer[LCD_ROWS][LCD_COLUMNS + 1];
 static int cursor_pos = 0;
 static int current_row = 0;
+static uint32_t row_mask;                       // Row pins in GPIO_IN_REG
+static uint8_t key_history[ROWS * COLS];        // Last DEBOUNCE_SAMPLES scans per key
+static uint16_t key_stable;                     // Debounced state, bit r * COLS + c
 
 // Keypad event structure
 typedef struct {
     char key;
     bool is_pressed;
+    TickType_t timestamp;  // Tick of the scan that made the new state stable
 } keypad_event_t;
 
 // Function declarations
 static esp_err_t i2c_master_init(void);
+static void lcd_batch_flush(lcd_batch_t *batch);
+static void lcd_batch_push(lcd_batch_t *batch, uint8_t value, uint8_t mode);
+static void lcd_batch_cmd(lcd_batch_t *batch, uint8_t cmd);
+static void lcd_batch_data(lcd_batch_t *batch, uint8_t data);
+static void lcd_batch_set_cursor(lcd_batch_t *batch, uint8_t col, uint8_t row);
+static void lcd_batch_str(lcd_batch_t *batch, const char *str);
+static void lcd_stats_begin_screen(void);
+static void lcd_stats_end_screen(const char *name);
 static void lcd_send_cmd(uint8_t cmd);
 static void lcd_send_data(uint8_t data);
 static void lcd_init(void);
-static void lcd_set_cursor(uint8_t col, uint8_t row);
 static void lcd_print_str(const char *str);
 static void update_lcd(void);
 void keypad_init(void);
-bool is_key_pressed(int row, int col);
+uint16_t keypad_scan(void);
+void keypad_debounce(uint16_t raw);
 void keypad_task(void *pvParameter);
 void handle_keypress(char key);
 void keypad_handler_task(void *pvParameter);
@@ -90,44 +125,90 @@ static esp_err_t i2c_master_init(void) {
     return i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0);
 }
 
-// Send command to LCD
-static void lcd_send_cmd(uint8_t cmd) {
-    uint8_t data_u = (cmd & 0xF0) | LCD_BACKLIGHT;
-    uint8_t data_l = ((cmd << 4) & 0xF0) | LCD_BACKLIGHT;
-    
-    uint8_t buf[4];
-    buf[0] = data_u | 0x04;
-    buf[1] = data_u & ~0x04;
-    buf[2] = data_l | 0x04;
-    buf[3] = data_l & ~0x04;
-    
+// LCD Batch Transport
+// Every HD44780 byte goes out as 4 PCF8574 bytes (high nibble then low nibble,
+// each strobed EN high/low). Queuing them in one buffer lets a whole line or
+// screen be written in a single I2C transaction instead of one per character.
+static void lcd_batch_flush(lcd_batch_t *batch) {
+    if (batch->len == 0) {
+        return;
+    }
+
     i2c_cmd_handle_t cmd_handle = i2c_cmd_link_create();
     i2c_master_start(cmd_handle);
     i2c_master_write_byte(cmd_handle, (LCD_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write(cmd_handle, buf, 4, true);
+    i2c_master_write(cmd_handle, batch->buf, batch->len, true);
     i2c_master_stop(cmd_handle);
     i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(1000));
     i2c_cmd_link_delete(cmd_handle);
+
+    // Address byte + payload
+    lcd_stats.total_bytes += batch->len + 1;
+    lcd_stats.total_transactions++;
+    lcd_stats.screen_bytes += batch->len + 1;
+    lcd_stats.screen_transactions++;
+    batch->len = 0;
+}
+
+static void lcd_batch_push(lcd_batch_t *batch, uint8_t value, uint8_t mode) {
+    if (batch->len + 4 > sizeof(batch->buf)) {
+        lcd_batch_flush(batch);
+    }
+
+    uint8_t data_u = (value & 0xF0) | LCD_BACKLIGHT | mode;
+    uint8_t data_l = ((value << 4) & 0xF0) | LCD_BACKLIGHT | mode;
+
+    batch->buf[batch->len++] = data_u | LCD_ENABLE;
+    batch->buf[batch->len++] = data_u & ~LCD_ENABLE;
+    batch->buf[batch->len++] = data_l | LCD_ENABLE;
+    batch->buf[batch->len++] = data_l & ~LCD_ENABLE;
+}
+
+static void lcd_batch_cmd(lcd_batch_t *batch, uint8_t cmd) {
+    lcd_batch_push(batch, cmd, LCD_COMMAND);
+}
+
+static void lcd_batch_data(lcd_batch_t *batch, uint8_t data) {
+    lcd_batch_push(batch, data, LCD_DATA);
+}
+
+static void lcd_batch_set_cursor(lcd_batch_t *batch, uint8_t col, uint8_t row) {
+    uint8_t row_offsets[] = {0x00, 0x40};
+    if (row >= LCD_ROWS) {
+        row = LCD_ROWS - 1;
+    }
+    lcd_batch_cmd(batch, LCD_SET_DDRAM_ADDR | (col + row_offsets[row]));
+}
+
+static void lcd_batch_str(lcd_batch_t *batch, const char *str) {
+    while (*str) {
+        lcd_batch_data(batch, *str++);
+    }
+}
+
+static void lcd_stats_begin_screen(void) {
+    lcd_stats.screen_bytes = 0;
+    lcd_stats.screen_transactions = 0;
+}
+
+static void lcd_stats_end_screen(const char *name) {
+    ESP_LOGD("LCD", "%s: %u bytes in %u transactions (total %u / %u)", name,
+             (unsigned)lcd_stats.screen_bytes, (unsigned)lcd_stats.screen_transactions,
+             (unsigned)lcd_stats.total_bytes, (unsigned)lcd_stats.total_transactions);
+}
+
+// Send command to LCD
+static void lcd_send_cmd(uint8_t cmd) {
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_cmd(&batch, cmd);
+    lcd_batch_flush(&batch);
 }
 
 // Send data to LCD
 static void lcd_send_data(uint8_t data) {
-    uint8_t data_u = (data & 0xF0) | LCD_BACKLIGHT | LCD_DATA;
-    uint8_t data_l = ((data << 4) & 0xF0) | LCD_BACKLIGHT | LCD_DATA;
-    
-    uint8_t buf[4];
-    buf[0] = data_u | 0x04;
-    buf[1] = data_u & ~0x04;
-    buf[2] = data_l | 0x04;
-    buf[3] = data_l & ~0x04;
-    
-    i2c_cmd_handle_t cmd_handle = i2c_cmd_link_create();
-    i2c_master_start(cmd_handle);
-    i2c_master_write_byte(cmd_handle, (LCD_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write(cmd_handle, buf, 4, true);
-    i2c_master_stop(cmd_handle);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd_handle, pdMS_TO_TICKS(1000));
-    i2c_cmd_link_delete(cmd_handle);
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_data(&batch, data);
+    lcd_batch_flush(&batch);
 }
 
 // Initialize LCD
@@ -148,33 +229,29 @@ static void lcd_init(void) {
     lcd_send_cmd(LCD_ENTRY_MODE_SET | 0x02);
 }
 
-// Set cursor position
-static void lcd_set_cursor(uint8_t col, uint8_t row) {
-    uint8_t row_offsets[] = {0x00, 0x40};
-    if (row >= LCD_ROWS) {
-        row = LCD_ROWS - 1;
-    }
-    lcd_send_cmd(LCD_SET_DDRAM_ADDR | (col + row_offsets[row]));
-}
-
 // Print string to LCD
 static void lcd_print_str(const char *str) {
-    while (*str) {
-        lcd_send_data(*str++);
-    }
+    lcd_batch_t batch = { .len = 0 };
+    lcd_batch_str(&batch, str);
+    lcd_batch_flush(&batch);
 }
 
 // Update LCD display
 static void update_lcd(void) {
+    lcd_batch_t batch = { .len = 0 };
+    lcd_stats_begin_screen();
+
     lcd_send_cmd(LCD_CLEAR_DISPLAY);
     vTaskDelay(pdMS_TO_TICKS(2));
     
     for (int row = 0; row < LCD_ROWS; row++) {
-        lcd_set_cursor(0, row);
-        lcd_print_str(lcd_buffer[row]);
+        lcd_batch_set_cursor(&batch, 0, row);
+        lcd_batch_str(&batch, lcd_buffer[row]);
     }
     
-    lcd_set_cursor(cursor_pos, current_row);
+    lcd_batch_set_cursor(&batch, cursor_pos, current_row);
+    lcd_batch_flush(&batch);
+    lcd_stats_end_screen("keys");
 }
 
 // Initialize keypad
@@ -190,39 +267,69 @@ void keypad_init(void) {
         gpio_set_direction(col_pins[i], GPIO_MODE_OUTPUT);
         gpio_set_level(col_pins[i], 1);
     }
+
+    // All row pins are below GPIO32, so one GPIO_IN_REG read covers them
+    row_mask = 0;
+    for (int i = 0; i < ROWS; i++) {
+        row_mask |= BIT(row_pins[i]);
+    }
+}
+
+// Scan the whole matrix: each column is driven low once and all four rows
+// are taken from a single input register read. Bit r * COLS + c is set while
+// that key is down. No delays beyond the column settle time.
+uint16_t keypad_scan(void) {
+    uint16_t raw = 0;
+
+    for (int c = 0; c < COLS; c++) {
+        gpio_set_level(col_pins[c], 0);
+        esp_rom_delay_us(COLUMN_SETTLE_US);
+        uint32_t in = ~REG_READ(GPIO_IN_REG) & row_mask;
+        gpio_set_level(col_pins[c], 1);
+
+        for (int r = 0; r < ROWS; r++) {
+            if (in & BIT(row_pins[r])) {
+                raw |= 1u << (r * COLS + c);
+            }
+        }
+    }
+    return raw;
 }
 
-// Check if key is pressed
-bool is_key_pressed(int row, int col) {
-    gpio_set_level(col_pins[col], 0);
-    vTaskDelay(pdMS_TO_TICKS(DEBOUNCE_DELAY_MS));
-    bool pressed = (gpio_get_level(row_pins[row]) == 0);
-    gpio_set_level(col_pins[col], 1);
-    return pressed;
+// Debounce across scans: a key changes state after DEBOUNCE_SAMPLES equal
+// scans, i.e. DEBOUNCE_DELAY_MS, and every change is queued as an event
+void keypad_debounce(uint16_t raw) {
+    TickType_t now = xTaskGetTickCount();
+
+    for (int k = 0; k < ROWS * COLS; k++) {
+        uint16_t bit = 1u << k;
+        key_history[k] = ((key_history[k] << 1) | ((raw & bit) ? 1 : 0)) & DEBOUNCE_MASK;
+
+        bool pressed;
+        if (key_history[k] == DEBOUNCE_MASK && !(key_stable & bit)) {
+            pressed = true;
+        } else if (key_history[k] == 0 && (key_stable & bit)) {
+            pressed = false;
+        } else {
+            continue;
+        }
+
+        key_stable ^= bit;
+        keypad_event_t event = {
+            .key = keymap[k / COLS][k % COLS],
+            .is_pressed = pressed,
+            .timestamp = now
+        };
+        if (xQueueSend(keypad_queue, &event, 0) != pdTRUE) {
+            ESP_LOGW("KEYPAD", "Event queue full, dropped %c", event.key);
+        }
+    }
 }
 
 // Keypad scanning task
 void keypad_task(void *pvParameter) {
     while (1) {
-        for (int c = 0; c < COLS; c++) {
-            gpio_set_level(col_pins[c], 0);
-            
-            for (int r = 0; r < ROWS; r++) {
-                if (is_key_pressed(r, c)) {
-                    while (is_key_pressed(r, c)) {
-                        vTaskDelay(pdMS_TO_TICKS(10));
-                    }
-                    
-                    keypad_event_t event = {
-                        .key = keymap[r][c],
-                        .is_pressed = true
-                    };
-                    xQueueSend(keypad_queue, &event, portMAX_DELAY);
-                }
-            }
-            
-            gpio_set_level(col_pins[c], 1);
-        }
+        keypad_debounce(keypad_scan());
         vTaskDelay(pdMS_TO_TICKS(SCAN_INTERVAL_MS));
     }
 }
@@ -10,6 +10,19 @@ const int buttonPin = 27;
 const int ledPin = 26;
 bool isAuthenticated = false;
 
+// Login attempt limit, same policy as the keypad in Final.c: 3 wrong
+// passwords, then a lockout doubling from 30 s up to 4 h, with one attempt
+// regained per hour. Kept in RAM only.
+const int loginBurst = 3;
+const unsigned long loginRefillMs = 60UL * 60 * 1000;
+const unsigned long loginBackoffBaseMs = 30000;
+const unsigned long loginBackoffMaxMs = 4UL * 60 * 60 * 1000;
+int loginTokens = loginBurst;
+int loginStrikes = 0;
+unsigned long loginRefilledAt = 0;
+unsigned long loginLockedAt = 0;
+unsigned long loginLockMs = 0;
+
 void handleRoot() {
   char msg[1000];
   snprintf(msg, 1000,
@@ -38,13 +51,51 @@ void handleRoot() {
   server.send(200, "text/html", msg);
 }
 
+// Milliseconds until the next login attempt is allowed, 0 if it is now
+unsigned long loginWaitMs() {
+  unsigned long now = millis();
+
+  if (loginTokens == 0) {
+    if (now - loginLockedAt < loginLockMs) {
+      return loginLockMs - (now - loginLockedAt);
+    }
+    loginTokens = 1;  // The lockout has been served
+    loginRefilledAt = loginLockedAt + loginLockMs;
+  }
+  while (loginTokens < loginBurst && now - loginRefilledAt >= loginRefillMs) {
+    loginTokens++;
+    loginRefilledAt += loginRefillMs;
+  }
+  return 0;
+}
+
+void loginRecord(bool ok) {
+  if (ok) {
+    loginTokens = loginBurst;
+    loginStrikes = 0;
+    return;
+  }
+  if (loginTokens == loginBurst) {
+    loginRefilledAt = millis();
+  }
+  if (--loginTokens == 0) {
+    loginStrikes++;
+    loginLockMs = loginStrikes > 14 ? loginBackoffMaxMs : min(loginBackoffBaseMs << (loginStrikes - 1), loginBackoffMaxMs);
+    loginLockedAt = millis();
+    Serial.printf("Login locked out for %lu s\n", loginLockMs / 1000);
+  }
+}
+
 void handleLogin() {
+  if (loginWaitMs() > 0) {
+    server.send(429, "text/plain", "Too many attempts, try later");
+    return;
+  }
   if (server.hasArg("pass")) {
-    if (server.arg("pass") == correctPassword) {
-      isAuthenticated = true;
+    isAuthenticated = server.arg("pass") == correctPassword;
+    loginRecord(isAuthenticated);
+    if (isAuthenticated) {
       blinkLED();
-    } else {
-      isAuthenticated = false;
     }
   }
   server.sendHeader("Location", "/");